@@ -8,6 +8,8 @@ struct rtcdate;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct schedevent;
+struct pstat;
 struct superblock;
 
 // bio.c
@@ -78,6 +80,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -124,6 +127,13 @@ void            setPriority(int, int);
 int             getLevel(void);
 void            schedulerLock(int);
 void            schedulerUnlock(int);
+void            boosttick(void);
+void            syncboost(struct proc*);
+int             getpstat(struct pstat*, int);
+int             setTickets(int, int);
+int             setStrideShare(int);
+int             setaffinity(int, int);
+int             getaffinity(int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -163,6 +173,11 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// trace.c
+void            traceinit(void);
+void            trace(int, struct proc*, int);
+int             traceread(struct schedevent*, int);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
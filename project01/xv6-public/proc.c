@@ -6,15 +6,36 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+#include "trace.h"
+#include "pstat.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
   int upper_bound; // Global Ticks. For priority boosting.
+  uint epoch; // Number of priority boosts so far
   int is_lock; // check lock on/off
   struct proc* lock_process; // Lock Process
+  struct proc *sheap[NPROC]; // Runnable stride processes, min-heap by pass
+  int nsheap; // Number of processes in sheap
+  uint svtime; // Pass of the last stride process picked
+  int sharepct; // Percent of CPU time for the stride class
+  uint spass; // Stride class pass
+  uint mpass; // MLFQ class pass
 } ptable; // table of process
 
+// Sleeping processes, hashed by the channel they sleep on, so that
+// wakeup only looks at processes that may be sleeping on its chan.
+// Guarded by ptable.lock.
+#define SLEEPQBITS 6
+#define NSLEEPQ (1 << SLEEPQBITS)
+static struct proc *sleepq[NSLEEPQ];
+
+// rqlock[i] guards cpus[i].rq, nrun and rqepoch. When two are held,
+// as for stealing, the one of the lower-numbered CPU is taken first.
+static struct spinlock rqlock[NCPU];
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -26,7 +47,504 @@ static void wakeup1(void *chan);
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NCPU; i++)
+    initlock(&rqlock[i], "rq");
+  ptable.sharepct = 50;
+}
+
+//PAGEBREAK: 30
+// Run queue maintenance. Every CPU has its own set of MLFQ queues.
+// A process is on exactly one run queue, the one of p->cpu, if and
+// only if its state is RUNNABLE, except that pickproc() takes the
+// one it picks off and marks it claimed by the picking CPU until it
+// runs. ptable.lock guards process state, so the functions that
+// change it must be called with it held; each CPU's queues also
+// have their own lock, so that a CPU picking, polling or stealing
+// from them need not hold ptable.lock.
+
+// Queue a process belongs to: L0, L1, or the L2 queue of its priority.
+static int
+runqidx(struct proc *p)
+{
+  if(p->q_lv < 2)
+    return p->q_lv;
+  return 2 + p->priority;
+}
+
+// Priority boosting is lazy. boosttick() only bumps ptable.epoch;
+// a process whose epoch is behind is reset to the top of L0 the
+// next time it is queued, dequeued or checked by trap(), and a CPU
+// whose queues are behind moves them all onto L0 the next time it
+// touches them. A boost therefore never walks the process table.
+
+// Apply any boost p has missed. Only p itself, a holder of
+// ptable.lock, or a holder of the rqlock of the queue p is on may
+// call this.
+void
+syncboost(struct proc *p)
+{
+  if(p->epoch == ptable.epoch)
+    return;
+  p->epoch = ptable.epoch;
+  p->tq = 0;
+  p->q_lv = 0;
+  p->priority = 3;
+  p->nboost++;
+}
+
+// Apply any boost c's queues have missed: move L1 and L2 behind L0,
+// keeping their order. Every process on them is then either current
+// and on the queue runqidx() gives, or behind and on L0, which is
+// where syncboost() will put it. c's rqlock must be held.
+static void
+syncrunq(struct cpu *c)
+{
+  struct runq l0;
+  int i;
+
+  if(c->rqepoch == ptable.epoch)
+    return;
+  c->rqepoch = ptable.epoch;
+
+  l0 = c->rq[0];
+  for(i = 1; i < NRUNQ; i++){
+    if(c->rq[i].head == 0)
+      continue;
+    if(l0.tail){
+      l0.tail->next = c->rq[i].head;
+      c->rq[i].head->prev = l0.tail;
+    } else
+      l0.head = c->rq[i].head;
+    l0.tail = c->rq[i].tail;
+    c->rq[i].head = c->rq[i].tail = 0;
+  }
+  c->rq[0] = l0;
+}
+
+// Stride scheduling. A process with tickets is in the stride class:
+// instead of an MLFQ queue it waits in ptable.sheap, a binary heap
+// ordered by pass, and every tick it runs adds STRIDE1/tickets to
+// its pass. The lowest pass runs next. The two classes split the
+// CPU the same way, with ptable.sharepct percent for stride.
+
+#define STRIDE1 (1 << 20)
+
+// Whether pass a is before pass b. Passes may wrap around.
+static int
+passlt(uint a, uint b)
+{
+  return (int)(a - b) < 0;
+}
+
+static void
+heapswap(int i, int j)
+{
+  struct proc *p;
+
+  p = ptable.sheap[i];
+  ptable.sheap[i] = ptable.sheap[j];
+  ptable.sheap[j] = p;
+  ptable.sheap[i]->hidx = i;
+  ptable.sheap[j]->hidx = j;
+}
+
+static void
+heapup(int i)
+{
+  while(i > 0 && passlt(ptable.sheap[i]->pass, ptable.sheap[(i-1)/2]->pass)){
+    heapswap(i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void
+heapdown(int i)
+{
+  int m, l;
+
+  for(;;){
+    m = i;
+    l = 2*i + 1;
+    if(l < ptable.nsheap && passlt(ptable.sheap[l]->pass, ptable.sheap[m]->pass))
+      m = l;
+    if(l+1 < ptable.nsheap && passlt(ptable.sheap[l+1]->pass, ptable.sheap[m]->pass))
+      m = l+1;
+    if(m == i)
+      return;
+    heapswap(i, m);
+    i = m;
+  }
+}
+
+static void
+heappush(struct proc *p)
+{
+  // A process that slept must not come back with banked credit,
+  // nor may the class, which scheduler() does not catch up while
+  // it is empty.
+  if(passlt(p->pass, ptable.svtime))
+    p->pass = ptable.svtime;
+  if(ptable.nsheap == 0 && passlt(ptable.spass, ptable.mpass))
+    ptable.spass = ptable.mpass;
+  p->hidx = ptable.nsheap++;
+  ptable.sheap[p->hidx] = p;
+  heapup(p->hidx);
+}
+
+static void
+heapdel(struct proc *p)
+{
+  int i;
+
+  i = p->hidx;
+  ptable.nsheap--;
+  if(i != ptable.nsheap){
+    heapswap(i, ptable.nsheap);
+    heapup(i);
+    heapdown(i);
+  }
+}
+
+// Link p into its queue on CPU c, at the head if front is set.
+// c's rqlock must be held.
+static void
+rqlink(struct cpu *c, struct proc *p, int front)
+{
+  struct runq *q;
+
+  syncrunq(c);
+  syncboost(p);
+  q = &c->rq[runqidx(p)];
+
+  if(front){
+    p->prev = 0;
+    p->next = q->head;
+    if(q->head)
+      q->head->prev = p;
+    else
+      q->tail = p;
+    q->head = p;
+  } else {
+    p->next = 0;
+    p->prev = q->tail;
+    if(q->tail)
+      q->tail->next = p;
+    else
+      q->head = p;
+    q->tail = p;
+  }
+  p->cpu = c;
+  c->nrun++;
+}
+
+// Unlink p from its queue. p's q_lv and priority must not have
+// changed since it was queued, other than by a boost. The rqlock
+// of p->cpu must be held.
+static void
+rqunlink(struct proc *p)
+{
+  struct runq *q;
+
+  syncrunq(p->cpu);
+  syncboost(p);
+  q = &p->cpu->rq[runqidx(p)];
+
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    q->head = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+  else
+    q->tail = p->prev;
+  p->next = p->prev = 0;
+  p->cpu->nrun--;
+}
+
+// Append p to the tail of its queue on CPU c.
+static void
+enqueue(struct cpu *c, struct proc *p)
+{
+  if(p->tickets){
+    heappush(p);
+    p->cpu = c;
+  } else {
+    acquire(&rqlock[c - cpus]);
+    rqlink(c, p, 0);
+    release(&rqlock[c - cpus]);
+  }
+  p->time = ticks;
+}
+
+// Put p at the head of its queue on CPU c so it is picked next.
+static void
+enqueuefront(struct cpu *c, struct proc *p)
+{
+  if(p->tickets){
+    enqueue(c, p);
+    return;
+  }
+
+  acquire(&rqlock[c - cpus]);
+  rqlink(c, p, 1);
+  release(&rqlock[c - cpus]);
+  p->time = ticks;
+}
+
+// Take p off its queue. If a CPU has claimed it, p is off already;
+// the claim is dropped instead, and the CPU will not run it.
+static void
+dequeue(struct proc *p)
+{
+  struct spinlock *lk;
+
+  if(p->tickets)
+    heapdel(p);
+  else {
+    // A steal may move p to another CPU until we hold the lock.
+    for(;;){
+      lk = &rqlock[p->cpu - cpus];
+      acquire(lk);
+      if(lk == &rqlock[p->cpu - cpus])
+        break;
+      release(lk);
+    }
+    if(p->claim)
+      p->claim = 0;
+    else
+      rqunlink(p);
+    release(lk);
+  }
+  p->waitticks += ticks - p->time;
+}
+
+// Whether p may run on CPU c.
+static int
+allowed(struct proc *p, struct cpu *c)
+{
+  return (p->affinity >> (c - cpus)) & 1;
+}
+
+// CPU with the fewest queued processes that p may run on.
+// New processes go there.
+static struct cpu*
+idlestcpu(struct proc *p)
+{
+  struct cpu *c, *best;
+
+  best = 0;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(allowed(p, c) && (best == 0 || c->nrun < best->nrun))
+      best = c;
+  return best;
+}
+
+// Mark p RUNNABLE and queue it on CPU c, or on the least loaded
+// CPU it may run on if c is not one of them.
+static void
+makerunnable(struct proc *p, struct cpu *c)
+{
+  if(!allowed(p, c))
+    c = idlestcpu(p);
+  p->state = RUNNABLE;
+  enqueue(c, p);
+  trace(EV_READY, p, 0);
+}
+
+// Take the first process on CPU v's queue i that CPU c may run,
+// claimed by c, and return it; or return 0.
+static struct proc*
+steal(struct cpu *c, struct cpu *v, int i)
+{
+  struct spinlock *lo, *hi;
+  struct proc *p;
+
+  lo = &rqlock[c - cpus];
+  hi = &rqlock[v - cpus];
+  if(v < c){
+    lo = hi;
+    hi = &rqlock[c - cpus];
+  }
+  acquire(lo);
+  acquire(hi);
+  syncrunq(v);
+  for(p = v->rq[i].head; p; p = p->next)
+    if(allowed(p, c))
+      break;
+  if(p){
+    rqunlink(p);
+    p->cpu = c;
+    p->claim = c;
+  }
+  release(hi);
+  release(lo);
+  return p;
+}
+
+// Next process for CPU c to run, or 0 if there is none anywhere.
+// Levels are served in MLFQ order across the whole machine: c's own
+// queue is used first, and if it is empty at that level the work is
+// stolen from the first other CPU that has some c may run. A
+// process is only queued on a CPU it may run on, and only moves
+// when stolen, so it keeps to the CPU it last ran on while that
+// one keeps up.
+// The process returned is off the queues and claimed by c, so that
+// no other CPU picks it too; it needs only the rqlocks, not
+// ptable.lock. runproc() or unpick() must follow.
+static struct proc*
+pickproc(struct cpu *c)
+{
+  struct cpu *v;
+  struct proc *p;
+  int i, n, own;
+
+  // Only levels above c's own best are worth stealing from.
+  acquire(&rqlock[c - cpus]);
+  syncrunq(c);
+  for(own = 0; own < NRUNQ; own++)
+    if(c->rq[own].head)
+      break;
+  release(&rqlock[c - cpus]);
+  for(i = 0; i < own; i++){
+    for(n = 1; n < ncpu; n++){
+      v = &cpus[(c - cpus + n) % ncpu];
+      if(v->nrun > 0 && (p = steal(c, v, i)) != 0)
+        return p;
+    }
+  }
+
+  // Nothing better elsewhere: c's own, if it still has any.
+  acquire(&rqlock[c - cpus]);
+  syncrunq(c);
+  for(own = 0; own < NRUNQ; own++)
+    if(c->rq[own].head)
+      break;
+  p = 0;
+  if(own < NRUNQ){
+    p = c->rq[own].head;
+    rqunlink(p);
+    p->claim = c;
+  }
+  release(&rqlock[c - cpus]);
+  return p;
+}
+
+// Give back p, which c picked but will not run after all, unless
+// someone took it off c while c was not holding ptable.lock, which
+// must be held now.
+static void
+unpick(struct cpu *c, struct proc *p)
+{
+  if(p->claim != c)
+    return;
+  dequeue(p);
+  enqueuefront(allowed(p, c) ? c : idlestcpu(p), p);
+}
+
+// Sleep queue bucket for chan.
+static struct proc**
+sleepbucket(void *chan)
+{
+  // Fibonacci hashing: the top bits of chan * 2^32/phi.
+  return &sleepq[((uint)chan * 2654435761U) >> (32 - SLEEPQBITS)];
+}
+
+// Put p, which is about to sleep on p->chan, on its sleep queue.
+static void
+sleepqadd(struct proc *p)
+{
+  struct proc **b = sleepbucket(p->chan);
+
+  p->slnext = *b;
+  *b = p;
+}
+
+// Take sleeping p off its sleep queue.
+static void
+sleepqdel(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = sleepbucket(p->chan); *pp; pp = &(*pp)->slnext){
+    if(*pp == p){
+      *pp = p->slnext;
+      p->slnext = 0;
+      return;
+    }
+  }
+  panic("sleepqdel");
+}
+
+// Whether there is queued work CPU c may run. Reads the stride heap
+// and process states without ptable.lock so idle CPUs can poll
+// without bouncing the lock; the caller rechecks under it.
+static int
+runnablehere(struct cpu *c)
+{
+  struct cpu *v;
+  struct proc *p;
+  int i, found;
+
+  __sync_synchronize();
+  if(ptable.is_lock){
+    p = ptable.lock_process;
+    return p != 0 && p->state == RUNNABLE && allowed(p, c);
+  }
+  if(c->nrun > 0)
+    return 1;
+  for(i = 0; i < ptable.nsheap; i++)
+    if(allowed(ptable.sheap[i], c))
+      return 1;
+  for(v = cpus; v < cpus+ncpu; v++){
+    if(v == c || v->nrun == 0)
+      continue;
+    found = 0;
+    acquire(&rqlock[v - cpus]);
+    for(i = 0; i < NRUNQ && !found; i++)
+      for(p = v->rq[i].head; p && !found; p = p->next)
+        found = allowed(p, c);
+    release(&rqlock[v - cpus]);
+    if(found)
+      return 1;
+  }
+  return 0;
+}
+
+// Wake a halted CPU to run p, just queued on c: c itself if it is
+// halted, otherwise any halted CPU p may run on, which will steal
+// it. The barrier pairs with the one in idle(): either we see the
+// CPU's idle flag or it sees the queued process.
+static void
+kick(struct proc *p, struct cpu *c)
+{
+  struct cpu *v;
+
+  __sync_synchronize();
+  if(c != mycpu() && c->idle){
+    lapicipi(c->apicid, T_IRQ0 + IRQ_WAKE);
+    return;
+  }
+  for(v = cpus; v < cpus+ncpu; v++){
+    if(v != mycpu() && v->idle && allowed(p, v)){
+      lapicipi(v->apicid, T_IRQ0 + IRQ_WAKE);
+      return;
+    }
+  }
+}
+
+// Halt CPU c until the next interrupt: a timer tick or a kick(),
+// unless work it may run turned up after it last looked.
+static void
+idle(struct cpu *c)
+{
+  cli();
+  c->idle = 1;
+  if(!runnablehere(c))
+    stihlt();
+  c->idle = 0;
 }
 
 // Must be called with interrupts disabled
@@ -95,6 +613,16 @@ found:
   p->tq = 0;
   p->priority = 3;
   p->time = ticks;
+  p->epoch = ptable.epoch;
+  p->runticks = p->waitticks = 0;
+  p->chargedticks = 0;
+  p->nvcsw = p->nivcsw = 0;
+  p->ndemote = p->nboost = 0;
+  memset(p->lvticks, 0, sizeof(p->lvticks));
+  p->cruntick = p->cwaittick = 0;
+  p->tickets = 0;
+  p->pass = 0;
+  p->affinity = ~0;
   
   release(&ptable.lock);
 
@@ -155,7 +683,7 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  makerunnable(p, mycpu());
 
   release(&ptable.lock);
 }
@@ -211,6 +739,7 @@ fork(void)
   np->q_lv = 0;
   np->time = ticks;
   np->priority = 3;
+  np->affinity = curproc->affinity;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -226,7 +755,8 @@ fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  makerunnable(np, idlestcpu(np));
+  kick(np, np->cpu);
 
   release(&ptable.lock);
 
@@ -299,6 +829,8 @@ wait(void)
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
+        curproc->cruntick += p->runticks + p->cruntick;
+        curproc->cwaittick += p->waitticks + p->cwaittick;
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
@@ -323,6 +855,128 @@ wait(void)
   }
 }
 
+// Whether the next process should come from the stride class.
+// A class with nothing to run gives up its turn and has its pass
+// caught up, so it cannot bank CPU time while empty.
+static int
+stridenext(void)
+{
+  struct cpu *c;
+  int mlfq;
+
+  mlfq = 0;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c->nrun > 0)
+      mlfq = 1;
+
+  if(ptable.nsheap == 0){
+    if(passlt(ptable.spass, ptable.mpass))
+      ptable.spass = ptable.mpass;
+    return 0;
+  }
+  if(!mlfq){
+    if(passlt(ptable.mpass, ptable.spass))
+      ptable.mpass = ptable.spass;
+    return 1;
+  }
+  if(ptable.sharepct == 0)
+    return 0;
+  if(ptable.sharepct == 100)
+    return 1;
+  return !passlt(ptable.mpass, ptable.spass);
+}
+
+// Stride process with the lowest pass that CPU c may run, or 0.
+// That is the heap root unless affinity rules it out.
+static struct proc*
+stridepick(struct cpu *c)
+{
+  struct proc *p;
+  int i;
+
+  p = 0;
+  if(ptable.nsheap > 0 && allowed(ptable.sheap[0], c))
+    p = ptable.sheap[0];
+  else {
+    for(i = 1; i < ptable.nsheap; i++)
+      if(allowed(ptable.sheap[i], c) &&
+         (p == 0 || passlt(ptable.sheap[i]->pass, p->pass)))
+        p = ptable.sheap[i];
+  }
+  if(p)
+    ptable.svtime = p->pass;
+  return p;
+}
+
+// Charge p and its class for the ticks p has run since it was last
+// charged. Called as p gives up the CPU, before it is queued again,
+// so that it needs no lock of its own every tick. Must be called
+// with ptable.lock held.
+static void
+chargerun(struct proc *p)
+{
+  uint n;
+
+  n = p->runticks - p->chargedticks;
+  if(n == 0)
+    return;
+  p->chargedticks = p->runticks;
+  if(p->tickets){
+    p->pass += n * (STRIDE1 / p->tickets);
+    if(ptable.sharepct > 0)
+      ptable.spass += n * (STRIDE1 / ptable.sharepct);
+  } else if(ptable.sharepct < 100)
+    ptable.mpass += n * (STRIDE1 / (100 - ptable.sharepct));
+}
+
+// Process CPU c should run next, or 0 if there is none.
+// Must be called with ptable.lock held.
+static struct proc*
+nextproc(struct cpu *c)
+{
+  struct proc *p;
+
+  if(ptable.is_lock) {
+    //sched lock process.
+    //In the middle of the lock processing, process can sleep or die.
+    //so we have to check state of lock_process
+    p = ptable.lock_process;
+    if(p->state != RUNNABLE || !allowed(p, c))
+      return 0;
+    return p;
+  }
+
+  // If the class whose turn it is has nothing c may run, c runs
+  // the other one.
+  if(stridenext()){
+    if((p = stridepick(c)) != 0)
+      return p;
+    return pickproc(c);
+  }
+
+  //mlfq_sched
+  //L0, L1 and L2 prio 0..3 are separate FIFOs, so the head of the
+  //first non-empty queue is the process to run. An idle CPU
+  //steals from the others.
+  if((p = pickproc(c)) != 0)
+    return p;
+  return stridepick(c);
+}
+
+// Make process p, which c has picked, the one running on c. The
+// caller then swtch()es to p->context. Must be called with
+// ptable.lock held.
+static void
+runproc(struct cpu *c, struct proc *p)
+{
+  dequeue(p);
+  p->cpu = c;
+  c->proc = p;
+  switchuvm(p);
+  p->state = RUNNING;
+  trace(EV_SWITCHIN, p, 0);
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -342,90 +996,46 @@ scheduler(void)
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-
-    struct proc* running_p = 0; // chosen process to run
-    int chk = 0; //
-
-    if(ptable.is_lock) {
-      //sched lock process.
-
-      running_p = ptable.lock_process;
-
-      //In the middle of the lock processing, process can sleep or die.
-      //so we have to check state of running_p
-      if(running_p->state == RUNNABLE) {
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-
-      c->proc = running_p;
-      switchuvm(running_p);
-      running_p->state = RUNNING;
-
-      //cprintf("!!LOCKED!! pid : %d | q_lv : %d | tq : %d| priority : %d | upper_bound : %d  \n", running_p->pid, running_p->q_lv , running_p->tq, running_p->priority, ptable.upper_bound);
-
-      swtch(&(c->scheduler), running_p->context);
-      switchkvm();
-
-      running_p->time = ticks;
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
-      } //else cprintf("Just Looping\n");
+    // Don't fight over ptable.lock while there is nothing to run.
+    if(!runnablehere(c)){
+      idle(c);
+      continue;
     }
-    else{
-      //mlfq_sched
-      //find which process is have to running-process
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-        if(p->state != RUNNABLE) continue;
-
-      // if queue level different, compare queue level
-      if(!chk || running_p->q_lv > p->q_lv) {
-        running_p = p;
-        chk = 1; // to put first process in running_p
-      }
 
-      // if queue level same, compare priority and time
-      else if (running_p->q_lv == p->q_lv) {
+    // Without stride processes or a scheduler lock the next
+    // process is the head of an MLFQ queue, which the rqlocks alone
+    // are enough to pick; ptable.lock is only needed to switch to
+    // it. Whatever changed before we got ptable.lock sends us the
+    // long way.
+    p = 0;
+    if(!ptable.is_lock && ptable.nsheap == 0)
+      p = pickproc(c);
 
-        if(running_p->q_lv == 2){ // L2 Queue
-          // if priority is different, compare priority. if priority is same, compare time
-          if((running_p->priority > p->priority)) running_p = p;
-          else if((running_p->priority == p->priority) && (running_p->time > p->time)) running_p = p;
-        }
+    acquire(&ptable.lock);
 
-        else { // L0, L1 Queue. compare time
-          if(running_p->time > p->time) running_p = p;
-        }
-      }
+    if(p && (ptable.is_lock || ptable.nsheap > 0 ||
+             p->claim != c || !allowed(p, c))){
+      unpick(c, p);
+      p = 0;
     }
-
-    if(chk == 1) {
+    if(p == 0)
+      p = nextproc(c);
+    if(p) {
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
-
-      c->proc = running_p;
-      switchuvm(running_p);
-      running_p->state = RUNNING;
-
-      //cprintf("pid : %d | q_lv : %d | tq : %d| priority : %d | upper_bound : %d  \n", running_p->pid, running_p->q_lv , running_p->tq, running_p->priority, ptable.upper_bound);
-
-      swtch(&(c->scheduler), running_p->context);
+      runproc(c, p);
+      swtch(&(c->scheduler), p->context);
       switchkvm();
 
-      running_p->time = ticks;
-    
       // Process is done running for now.
       // It should have changed its p->state before coming back.
+      // sched() may have handed the CPU straight on to other
+      // processes, so the one coming back is c->proc.
+      p = c->proc;
+      trace(EV_SWITCHOUT, p, p->state);
       c->proc = 0;
-
     }
-  }
 
     //  if scheduler lock_process finish, unlock scheduler
     if(ptable.is_lock == 1 && ptable.lock_process->state == ZOMBIE ) {
@@ -433,27 +1043,40 @@ scheduler(void)
       schedulerUnlock(2019030991);
       acquire(&ptable.lock);
     }
+    release(&ptable.lock);
 
-    ptable.upper_bound++;
+    // Work is queued but none of it may run here: wait for the
+    // next tick or a kick() instead of spinning on ptable.lock.
+    if(p == 0)
+      idle(c);
+  }
+}
 
-    if(ptable.upper_bound >= 100) { //Priority boosting
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-        p->tq = 0;
-        p->q_lv = 0;
-        p->priority = 3;
-        p->time = 0;
-      }
+// Called by trap() on every global timer tick. Every 100 ticks,
+// start a new boost epoch (see syncboost()) and unlock the
+// scheduler if it is locked. The count is atomic, so that a reset
+// by schedulerLock() is not lost, and ptable.lock is taken only
+// when a boost is due.
+void
+boosttick(void)
+{
+  if(__sync_add_and_fetch(&ptable.upper_bound, 1) < 100)
+    return;
 
-      // if scheduler lock and global ticks == 100, unlock scheduler
-      if(ptable.is_lock == 1) {
-        release(&ptable.lock);
-        schedulerUnlock(2019030991);
-        acquire(&ptable.lock);
-      }
-      ptable.upper_bound = 0;
-    }
+  acquire(&ptable.lock);
+  if(ptable.upper_bound >= 100) { //Priority boosting
+    ptable.epoch++;
+    ptable.upper_bound = 0;
+    trace(EV_BOOST, 0, ptable.epoch);
+
+    // if scheduler lock and global ticks == 100, unlock scheduler
+    if(ptable.is_lock == 1) {
       release(&ptable.lock);
+      schedulerUnlock(2019030991);
+      return;
+    }
   }
+  release(&ptable.lock);
 }
 
 void
@@ -464,20 +1087,121 @@ setPriority(int pid, int priority)
   acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
     if(p->pid == pid) {
+      // a queued process moves to the queue of its new priority
+      if(p->state == RUNNABLE)
+        dequeue(p);
+      syncboost(p);
 
       //exception handling. if input is not id 0~3
       if(priority<0) p->priority = 0;
       else if(priority>3) p->priority = 3;
       else p->priority = priority;
+
+      if(p->state == RUNNABLE)
+        enqueue(p->cpu, p);
       break;
     }
   }
   release(&ptable.lock);
 }
 
+// Move process pid into the stride class with the given tickets,
+// or back to the MLFQ class with 0 tickets.
+int
+setTickets(int pid, int tickets)
+{
+  struct proc* p;
+
+  if(tickets < 0 || tickets > MAXTICKETS)
+    return -1;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+    if(p->pid == pid && p->state != UNUSED) {
+      if(p->state == RUNNABLE)
+        dequeue(p);
+
+      // a newcomer starts level with the others
+      if(p->tickets == 0)
+        p->pass = ptable.svtime;
+      p->tickets = tickets;
+
+      if(p->state == RUNNABLE)
+        enqueue(p->cpu, p);
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Let process pid run only on the CPUs whose bits are set in mask.
+// A queued process moves to a CPU it may run on now, a running one
+// at its next switch.
+int
+setaffinity(int pid, int mask)
+{
+  struct proc *p;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+    if(p->pid == pid && p->state != UNUSED) {
+      p->affinity = mask;
+      if(p->state == RUNNABLE && !allowed(p, p->cpu)){
+        dequeue(p);
+        makerunnable(p, p->cpu);
+        kick(p, p->cpu);
+      }
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// CPU mask of process pid, or -1 if there is none.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+    if(p->pid == pid && p->state != UNUSED) {
+      mask = p->affinity & ((1 << ncpu) - 1);
+      release(&ptable.lock);
+      return mask;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Give the stride class percent of the CPU time while both
+// classes have work.
+int
+setStrideShare(int percent)
+{
+  if(percent < 0 || percent > 100)
+    return -1;
+
+  acquire(&ptable.lock);
+  ptable.sharepct = percent;
+  release(&ptable.lock);
+  return 0;
+}
+
 int
 getLevel(void)
 {
+  syncboost(myproc());
   return myproc()->q_lv;
 }
 
@@ -505,6 +1229,7 @@ schedulerLock(int password)
     ptable.upper_bound = 0;
     ptable.is_lock = 1;
     ptable.lock_process = myproc();
+    trace(EV_LOCK, myproc(), 0);
   }
   else {
     // password ERROR
@@ -536,13 +1261,19 @@ schedulerUnlock(int password)
     ptable.is_lock = 0;
 
     p = ptable.lock_process;
-    
+
+    if(p->state == RUNNABLE)
+      dequeue(p);
+    syncboost(p);
+
     p->q_lv = 0;
     p->tq = 0;
     p->priority = 3;
 
     //make this process L0 queue first
-    p->time = -1;
+    if(p->state == RUNNABLE)
+      enqueuefront(p->cpu, p);
+    trace(EV_UNLOCK, p, 0);
 
     ptable.lock_process = 0;
   }
@@ -570,6 +1301,7 @@ sched(void)
 {
   int intena;
   struct proc *p = myproc();
+  struct proc *np;
 
   if(!holding(&ptable.lock))
     panic("sched ptable.lock");
@@ -579,8 +1311,17 @@ sched(void)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
+  chargerun(p);
   intena = mycpu()->intena;
-  swtch(&p->context, mycpu()->scheduler);
+  if(p->state != RUNNABLE && (np = nextproc(mycpu())) != 0){
+    // p blocked or exited: hand the CPU straight to the next
+    // process instead of passing through scheduler(), which
+    // would take a second swtch.
+    trace(EV_SWITCHOUT, p, p->state);
+    runproc(mycpu(), np);
+    swtch(&p->context, np->context);
+  } else
+    swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
 
@@ -589,7 +1330,8 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  chargerun(myproc());  // before its pass places it in the heap
+  makerunnable(myproc(), mycpu());
   sched();
   release(&ptable.lock);
 }
@@ -641,6 +1383,8 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->nvcsw++;
+  sleepqadd(p);
 
   sched();
 
@@ -660,11 +1404,19 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc *p, **pp;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  pp = sleepbucket(chan);
+  while((p = *pp) != 0){
+    if(p->chan != chan){
+      pp = &p->slnext;
+      continue;
+    }
+    *pp = p->slnext;
+    p->slnext = 0;
+    makerunnable(p, p->cpu);
+    kick(p, p->cpu);
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -689,8 +1441,11 @@ kill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING){
+        sleepqdel(p);
+        makerunnable(p, p->cpu);
+        kick(p, p->cpu);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -716,6 +1471,7 @@ procdump(void)
   };
   int i;
   struct proc *p;
+  struct cpu *c;
   char *state;
   uint pc[10];
 
@@ -734,4 +1490,50 @@ procdump(void)
     }
     cprintf("\n");
   }
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    cprintf("cpu%d: idle %d of %d ticks\n", c - cpus, c->idleticks, c->nticks);
+}
+
+// Copy statistics of up to n processes into ps.
+// Return the number of records filled.
+int
+getpstat(struct pstat *ps, int n)
+{
+  struct proc *p;
+  int i;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++){
+    if(p->state == UNUSED)
+      continue;
+    ps[i].pid = p->pid;
+    ps[i].ppid = p->parent ? p->parent->pid : 0;
+    ps[i].state = p->state;
+    safestrcpy(ps[i].name, p->name, sizeof(ps[i].name));
+    // as syncboost() would leave it, without touching p
+    if(p->epoch == ptable.epoch){
+      ps[i].level = p->q_lv;
+      ps[i].priority = p->priority;
+    } else {
+      ps[i].level = 0;
+      ps[i].priority = 3;
+    }
+    ps[i].runticks = p->runticks;
+    ps[i].waitticks = p->waitticks;
+    if(p->state == RUNNABLE)
+      ps[i].waitticks += ticks - p->time;
+    ps[i].nvcsw = p->nvcsw;
+    ps[i].nivcsw = p->nivcsw;
+    ps[i].ndemote = p->ndemote;
+    ps[i].nboost = p->nboost;
+    memmove(ps[i].lvticks, p->lvticks, sizeof(ps[i].lvticks));
+    ps[i].tickets = p->tickets;
+    ps[i].cruntick = p->cruntick;
+    ps[i].cwaittick = p->cwaittick;
+    i++;
+  }
+  release(&ptable.lock);
+  return i;
 }
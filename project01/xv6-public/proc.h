@@ -1,3 +1,14 @@
+// MLFQ run queues. L0 and L1 are plain FIFOs; L2 is split into
+// one FIFO per priority (0 is served first), so picking the next
+// process only looks at the queue heads.
+#define NPRIO        4                 // L2 priorities 0..3
+#define NRUNQ        (2 + NPRIO)       // L0, L1, L2 prio 0..3
+
+struct runq {
+  struct proc *head;
+  struct proc *tail;
+};
+
 // Per-CPU state
 struct cpu {
   uchar apicid;                // Local APIC ID (Advanced Programmable Interrupt Controller)
@@ -8,6 +19,12 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile int idle;           // Halted in scheduler(), needs an IPI to wake
+  uint nticks;                 // Timer ticks seen by this CPU
+  uint idleticks;              // Ticks of those with no process running
+  struct runq rq[NRUNQ];       // This CPU's MLFQ run queues (rqlock)
+  int nrun;                    // Number of processes on rq
+  uint rqepoch;                // Boost epoch rq was last brought up to
 };
 
 extern struct cpu cpus[NCPU];
@@ -40,6 +57,25 @@ struct proc {
   int tq;                      // Time quantum              
   int q_lv;                    // Queue level
   int time;                    // queue arrive time
+  uint epoch;                  // Boost epoch tq, q_lv, priority belong to
+  struct proc *next;           // Next process in its run queue
+  struct proc *prev;           // Previous process in its run queue
+  struct cpu *cpu;             // CPU that queued or last ran this process
+  struct cpu *claim;           // CPU that took it off its queue to run it
+  int tickets;                 // Stride class share, 0 for the MLFQ class
+  uint pass;                   // Stride pass value
+  int hidx;                    // Index in the stride heap while queued
+  uint affinity;               // Bit i set: may run on cpus[i]
+  uint chargedticks;           // runticks charged to pass, see chargerun()
+  uint runticks;               // Statistics, see pstat.h
+  uint waitticks;
+  uint nvcsw;
+  uint nivcsw;
+  uint ndemote;
+  uint nboost;
+  uint lvticks[NLEVEL];
+  uint cruntick;
+  uint cwaittick;
                               
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
@@ -50,6 +86,7 @@ struct proc {
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *slnext;         // Next process in chan's sleep queue
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
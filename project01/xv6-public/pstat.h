@@ -0,0 +1,21 @@
+// Per-process scheduling statistics, one record per process,
+// as copied out by the getpstat system call. Needs param.h.
+
+struct pstat {
+  int pid;
+  int ppid;              // parent's pid, or 0
+  int state;             // enum procstate
+  char name[16];
+  int level;             // MLFQ queue level
+  int priority;          // L2 priority
+  int tickets;           // stride tickets, 0 in the MLFQ class
+  uint runticks;         // ticks spent running
+  uint waitticks;        // ticks spent runnable, waiting for a CPU
+  uint nvcsw;            // voluntary switches (sleep, yield)
+  uint nivcsw;           // involuntary switches (time quantum over)
+  uint ndemote;          // moves down a level or priority
+  uint nboost;           // priority boosts applied
+  uint lvticks[NLEVEL];  // running ticks at each queue level
+  uint cruntick;         // runticks of reaped children, summed
+  uint cwaittick;        // waitticks of reaped children, summed
+};
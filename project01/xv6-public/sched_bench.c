@@ -0,0 +1,63 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// CPU-bound throughput benchmark for the MLFQ scheduler.
+// Boot with a different CPU count and compare loops/tick:
+//   make qemu CPUS=1 ... make qemu CPUS=8
+//   $ sched_bench [nworkers] [rounds]
+
+#define NUM_WORKER 8
+#define NUM_ROUND 200
+#define ROUND_LOOP 100000
+
+void
+work(int rounds)
+{
+  volatile int x = 0;
+  int i, j;
+
+  for (i = 0; i < rounds; i++)
+    for (j = 0; j < ROUND_LOOP; j++)
+      x += j;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nworker = NUM_WORKER;
+  int rounds = NUM_ROUND;
+  int i, start, elapsed;
+
+  if (argc > 1)
+    nworker = atoi(argv[1]);
+  if (argc > 2)
+    rounds = atoi(argv[2]);
+  if (nworker <= 0 || rounds <= 0) {
+    printf(1, "usage: sched_bench [nworkers] [rounds]\n");
+    exit();
+  }
+
+  printf(1, "sched_bench: %d workers x %d rounds\n", nworker, rounds);
+
+  start = uptime();
+  for (i = 0; i < nworker; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf(1, "sched_bench: fork failed\n");
+      break;
+    }
+    if (pid == 0) {
+      work(rounds);
+      exit();
+    }
+  }
+  while (wait() != -1);
+  elapsed = uptime() - start;
+
+  if (elapsed == 0)
+    elapsed = 1;
+  printf(1, "sched_bench: %d ticks, %d rounds/100 ticks\n",
+         elapsed, nworker * rounds * 100 / elapsed);
+  exit();
+}
@@ -0,0 +1,65 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "trace.h"
+
+// Dump scheduler trace events to the console, one per line:
+//   ev <seq> <tick> <cpu> <type> <pid> <level> <prio> <arg>
+// Capture the console on the host and feed it to schedtrace.pl.
+//   $ schedtrace <ticks> [command args...]
+
+#define NBUF 64
+
+struct schedevent buf[NBUF];
+
+void
+drain(void)
+{
+  int i, n;
+
+  while ((n = schedtrace(buf, NBUF)) > 0) {
+    for (i = 0; i < n; i++)
+      printf(1, "ev %d %d %d %d %d %d %d %d\n",
+             buf[i].seq, buf[i].tick, buf[i].cpu, buf[i].type,
+             buf[i].pid, buf[i].level, buf[i].prio, buf[i].arg);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int duration, start, pid;
+
+  if (argc < 2) {
+    printf(2, "usage: schedtrace ticks [command args...]\n");
+    exit();
+  }
+  duration = atoi(argv[1]);
+
+  // throw away what was recorded before we started
+  while (schedtrace(buf, NBUF) > 0);
+
+  if (argc > 2) {
+    pid = fork();
+    if (pid < 0) {
+      printf(2, "schedtrace: fork failed\n");
+      exit();
+    }
+    if (pid == 0) {
+      exec(argv[2], argv + 2);
+      printf(2, "schedtrace: exec %s failed\n", argv[2]);
+      exit();
+    }
+  }
+
+  start = uptime();
+  while (uptime() - start < duration) {
+    drain();
+    sleep(1);
+  }
+  drain();
+
+  if (argc > 2)
+    while (wait() != -1);
+  exit();
+}
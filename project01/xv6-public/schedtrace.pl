@@ -0,0 +1,102 @@
+#!/usr/bin/perl -w
+
+# Summarize a scheduler trace captured from the console.
+#
+#   make qemu-nox | tee xv6.log      then in xv6: schedtrace 500 mlfq_test 1
+#   ./schedtrace.pl xv6.log
+#
+# Reads the "ev ..." lines printed by schedtrace (see trace.h) and
+# prints, per process: how often it ran, its run time, its wait
+# from being queued to being switched in, and the ticks it spent
+# queued or running in each MLFQ level.
+
+use strict;
+
+my %EV = (1 => "ready", 2 => "in", 3 => "out", 4 => "demote",
+          5 => "boost", 6 => "lock", 7 => "unlock");
+
+my @evs;
+while(<>){
+    next unless /^ev (\d+) (\d+) (\d+) (\d+) (-?\d+) (-?\d+) (-?\d+) (-?\d+)\s*$/;
+    push @evs, { seq => $1, tick => $2, cpu => $3, type => $EV{$4} || "?",
+                 pid => $5, level => $6, prio => $7, arg => $8 };
+}
+die "no trace events found\n" unless @evs;
+@evs = sort { $a->{seq} <=> $b->{seq} } @evs;
+
+my (%p, %cpubusy, $boosts, $locks);
+$boosts = $locks = 0;
+
+sub proc {
+    my $pid = shift;
+    $p{$pid} ||= { runs => 0, run => 0, nwait => 0, wait => 0, maxwait => 0,
+                   demotes => 0, res => [0, 0, 0] };
+    return $p{$pid};
+}
+
+# time spent at the current level since the last level change
+sub settle {
+    my ($s, $tick) = @_;
+    return unless defined $s->{since};
+    $s->{res}[$s->{lvl}] += $tick - $s->{since};
+    $s->{since} = $tick;
+}
+
+for my $e (@evs){
+    my $t = $e->{tick};
+    if($e->{type} eq "boost"){ $boosts++; next; }
+    next if $e->{pid} == 0;
+    my $s = proc($e->{pid});
+
+    if($e->{type} eq "ready"){
+        $s->{ready} = $t;
+        $s->{since} = $t;
+        $s->{lvl} = $e->{level};
+    } elsif($e->{type} eq "in"){
+        if(defined $s->{ready}){
+            my $w = $t - $s->{ready};
+            $s->{nwait}++;
+            $s->{wait} += $w;
+            $s->{maxwait} = $w if $w > $s->{maxwait};
+            delete $s->{ready};
+        }
+        settle($s, $t);
+        $s->{since} = $t;
+        $s->{lvl} = $e->{level};
+        $s->{runs}++;
+        $s->{in} = $t;
+    } elsif($e->{type} eq "out"){
+        if(defined $s->{in}){
+            $s->{run} += $t - $s->{in};
+            $cpubusy{$e->{cpu}} += $t - $s->{in};
+            delete $s->{in};
+        }
+        settle($s, $t);
+        delete $s->{since};
+    } elsif($e->{type} eq "demote"){
+        settle($s, $t);
+        $s->{lvl} = $e->{level};
+        $s->{demotes}++;
+    } elsif($e->{type} eq "lock" || $e->{type} eq "unlock"){
+        $locks++;
+    }
+}
+
+my $span = $evs[-1]{tick} - $evs[0]{tick};
+printf "%d events over %d ticks, %d boosts, %d lock/unlock\n\n",
+    scalar(@evs), $span, $boosts, $locks;
+
+printf "%5s %6s %6s %8s %8s %6s %6s %6s %7s\n",
+    "pid", "runs", "run", "avgwait", "maxwait", "L0", "L1", "L2", "demote";
+for my $pid (sort { $a <=> $b } keys %p){
+    my $s = $p{$pid};
+    printf "%5d %6d %6d %8.2f %8d %6d %6d %6d %7d\n",
+        $pid, $s->{runs}, $s->{run},
+        $s->{nwait} ? $s->{wait} / $s->{nwait} : 0, $s->{maxwait},
+        @{$s->{res}}, $s->{demotes};
+}
+
+print "\n";
+for my $c (sort { $a <=> $b } keys %cpubusy){
+    printf "cpu%d: busy %d of %d ticks\n", $c, $cpubusy{$c}, $span;
+}
@@ -0,0 +1,108 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+// Check achieved CPU shares against configured ones. Three stride
+// processes with 100, 200 and 300 tickets spin next to one MLFQ
+// process; the stride class gets percent of the CPU. Shares only
+// add up on one CPU:
+//   make qemu CPUS=1
+//   $ stride_bench [percent] [ticks]
+
+#define NUM_TICKS 1000
+
+int tickets[] = { 0, 100, 200, 300 };
+#define NCHILD (sizeof(tickets)/sizeof(tickets[0]))
+
+struct pstat ps[NPROC];
+
+// Ticks this process has run so far.
+int
+runticks(void)
+{
+  int i, n, pid;
+
+  pid = getpid();
+  n = getpstat(ps, NPROC);
+  for (i = 0; i < n; i++)
+    if (ps[i].pid == pid)
+      return ps[i].runticks;
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int percent = 50;
+  int nticks = NUM_TICKS;
+  int fd[2], res[2], got[NCHILD];
+  int i, total, sumtickets, start, want, base;
+
+  if (argc > 1)
+    percent = atoi(argv[1]);
+  if (argc > 2)
+    nticks = atoi(argv[2]);
+  if (setStrideShare(percent) < 0 || nticks <= 0) {
+    printf(1, "usage: stride_bench [percent] [ticks]\n");
+    exit();
+  }
+  if (pipe(fd) < 0) {
+    printf(1, "stride_bench: pipe failed\n");
+    exit();
+  }
+
+  printf(1, "stride_bench: stride class %d%%, %d ticks\n", percent, nticks);
+
+  start = uptime() + 5;
+  for (i = 0; i < NCHILD; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf(1, "stride_bench: fork failed\n");
+      exit();
+    }
+    if (pid == 0) {
+      if (tickets[i])
+        setTickets(getpid(), tickets[i]);
+      while (uptime() < start)
+        ;
+      base = runticks();
+      while (uptime() < start + nticks)
+        ;
+      res[0] = i;
+      res[1] = runticks() - base;
+      write(fd[1], res, sizeof(res));
+      exit();
+    }
+  }
+  close(fd[1]);
+  memset(got, 0, sizeof(got));
+
+  total = 0;
+  for (i = 0; i < NCHILD; i++) {
+    if (read(fd[0], res, sizeof(res)) != sizeof(res))
+      break;
+    got[res[0]] = res[1];
+    total += res[1];
+  }
+  while (wait() != -1)
+    ;
+  if (total == 0)
+    total = 1;
+
+  sumtickets = 0;
+  for (i = 0; i < NCHILD; i++)
+    sumtickets += tickets[i];
+
+  printf(1, "tickets\tticks\tgot%%\twant%%\n");
+  for (i = 0; i < NCHILD; i++) {
+    if (tickets[i])
+      want = percent * tickets[i] / sumtickets;
+    else
+      want = 100 - percent;
+    printf(1, "%d\t%d\t%d\t%d\n", tickets[i], got[i],
+           got[i] * 100 / total, want);
+  }
+  exit();
+}
@@ -109,6 +109,12 @@ extern int sys_yield(void);
 extern int sys_getLevel(void);
 extern int sys_schedulerLock(void);
 extern int sys_schedulerUnlock(void);
+extern int sys_schedtrace(void);
+extern int sys_getpstat(void);
+extern int sys_setTickets(void);
+extern int sys_setStrideShare(void);
+extern int sys_setaffinity(void);
+extern int sys_getaffinity(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -138,6 +144,12 @@ static int (*syscalls[])(void) = {
 [SYS_getLevel] sys_getLevel,
 [SYS_schedulerLock] sys_schedulerLock,
 [SYS_schedulerUnlock] sys_schedulerUnlock,
+[SYS_schedtrace] sys_schedtrace,
+[SYS_getpstat] sys_getpstat,
+[SYS_setTickets] sys_setTickets,
+[SYS_setStrideShare] sys_setStrideShare,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_getaffinity] sys_getaffinity,
 };
 
 void
@@ -25,4 +25,10 @@
 #define SYS_getLevel 24
 #define SYS_setPriority 25
 #define SYS_schedulerLock 26
-#define SYS_schedulerUnlock 27
\ No newline at end of file
+#define SYS_schedulerUnlock 27
+#define SYS_schedtrace 28
+#define SYS_getpstat 29
+#define SYS_setTickets 30
+#define SYS_setStrideShare 31
+#define SYS_setaffinity 32
+#define SYS_getaffinity 33
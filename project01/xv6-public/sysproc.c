@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "trace.h"
+#include "pstat.h"
 
 int
 sys_fork(void)
@@ -100,13 +102,49 @@ sys_setPriority(void)
   return 0;
 }
 
+int
+sys_setTickets(void)
+{
+  int pid, tickets;
+  if(argint(0,&pid)<0) return -1;
+  if(argint(1,&tickets)<0) return -1;
+  return setTickets(pid,tickets);
+}
+
+int
+sys_setStrideShare(void)
+{
+  int percent;
+  if(argint(0,&percent)<0) return -1;
+  return setStrideShare(percent);
+}
+
+int
+sys_setaffinity(void)
+{
+  int pid, mask;
+  if(argint(0,&pid)<0) return -1;
+  if(argint(1,&mask)<0) return -1;
+  return setaffinity(pid,mask);
+}
+
+int
+sys_getaffinity(void)
+{
+  int pid;
+  if(argint(0,&pid)<0) return -1;
+  return getaffinity(pid);
+}
+
 int
 sys_yield(void) 
 {
+  syncboost(myproc());
   myproc()->q_lv = 2;
   myproc()->tq = 0;
   myproc()->time = ticks;
   myproc()->priority = 3;
+  myproc()->nvcsw++;
 
   yield();
   return 0;
@@ -137,3 +175,34 @@ sys_schedulerUnlock(void)
   schedulerUnlock(password);
   return 0;
 }
+
+// drain up to n scheduler trace events into the user buffer
+int
+sys_schedtrace(void)
+{
+  struct schedevent *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NCPU*NTRACE)
+    n = NCPU*NTRACE;  // all there can be; keeps n*sizeof in range
+  if(argptr(0, (char**)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return traceread(buf, n);
+}
+
+int
+sys_getpstat(void)
+{
+  struct pstat *ps;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;  // all there can be; keeps n*sizeof in range
+  if(argptr(0, (char**)&ps, n*sizeof(*ps)) < 0)
+    return -1;
+  return getpstat(ps, n);
+}
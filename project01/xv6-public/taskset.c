@@ -0,0 +1,41 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Run a command pinned to a set of CPUs, bit i for CPU i:
+//   $ taskset mask command [args...]
+// or show or change the mask of a running process:
+//   $ taskset -p pid [mask]
+
+int
+main(int argc, char *argv[])
+{
+  int pid, mask;
+
+  if (argc >= 3 && strcmp(argv[1], "-p") == 0) {
+    pid = atoi(argv[2]);
+    if (argc > 3 && setaffinity(pid, atoi(argv[3])) < 0) {
+      printf(2, "taskset: cannot set mask of pid %d\n", pid);
+      exit();
+    }
+    if ((mask = getaffinity(pid)) < 0) {
+      printf(2, "taskset: no pid %d\n", pid);
+      exit();
+    }
+    printf(1, "pid %d: mask %d\n", pid, mask);
+    exit();
+  }
+
+  if (argc < 3) {
+    printf(2, "usage: taskset mask command [args...]\n");
+    printf(2, "       taskset -p pid [mask]\n");
+    exit();
+  }
+  if (setaffinity(getpid(), atoi(argv[1])) < 0) {
+    printf(2, "taskset: bad mask %s\n", argv[1]);
+    exit();
+  }
+  exec(argv[2], argv + 2);
+  printf(2, "taskset: exec %s failed\n", argv[2]);
+  exit();
+}
@@ -0,0 +1,81 @@
+// Scheduler event tracing.
+//
+// Each CPU owns a ring of events. Only that CPU writes to it, with
+// interrupts off, so recording takes no lock; a full ring drops the
+// event. Readers serialize on tracelock among themselves and never
+// block the writers.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "trace.h"
+
+struct tracering {
+  volatile uint head;          // next slot to write, owned by the CPU
+  volatile uint tail;          // next slot to read, owned by readers
+  uint dropped;                // events lost to a full ring
+  struct schedevent ev[NTRACE];
+};
+
+static struct tracering rings[NCPU];
+static struct spinlock tracelock;
+static uint traceseq;
+
+void
+traceinit(void)
+{
+  initlock(&tracelock, "trace");
+}
+
+// Record an event on this CPU's ring.
+void
+trace(int type, struct proc *p, int arg)
+{
+  struct tracering *r;
+  struct schedevent *e;
+
+  pushcli();
+  r = &rings[cpuid()];
+  if(r->head - r->tail >= NTRACE){
+    r->dropped++;
+    popcli();
+    return;
+  }
+  e = &r->ev[r->head % NTRACE];
+  e->seq = __sync_fetch_and_add(&traceseq, 1);
+  e->tick = ticks;
+  e->type = type;
+  e->cpu = cpuid();
+  e->pid = p ? p->pid : 0;
+  e->level = p ? p->q_lv : 0;
+  e->prio = p ? p->priority : 0;
+  e->arg = arg;
+  __sync_synchronize();  // event is complete before it is published
+  r->head++;
+  popcli();
+}
+
+// Move up to n recorded events, oldest first per CPU, into buf.
+// Returns the number of events copied.
+int
+traceread(struct schedevent *buf, int n)
+{
+  struct tracering *r;
+  int i;
+
+  acquire(&tracelock);
+  i = 0;
+  for(r = rings; r < &rings[ncpu] && i < n; r++){
+    while(r->tail != r->head && i < n){
+      __sync_synchronize();  // see the event the head published
+      buf[i++] = r->ev[r->tail % NTRACE];
+      __sync_synchronize();  // done reading before the slot is reused
+      r->tail++;
+    }
+  }
+  release(&tracelock);
+  return i;
+}
@@ -0,0 +1,23 @@
+// Scheduler trace events. Each CPU records them in its own ring
+// (trace.c); the schedtrace system call drains them.
+
+#define EV_READY      1   // process queued to run
+#define EV_SWITCHIN   2   // scheduler switched to process
+#define EV_SWITCHOUT  3   // process gave up the CPU; arg = new state
+#define EV_DEMOTE     4   // time quantum used up; level/prio are new
+#define EV_BOOST      5   // priority boost; arg = boost epoch
+#define EV_LOCK       6   // schedulerLock by process
+#define EV_UNLOCK     7   // schedulerUnlock of process
+
+#define NTRACE 256  // events per CPU ring
+
+struct schedevent {
+  uint seq;       // order of events across all CPUs
+  uint tick;      // ticks when recorded
+  ushort type;    // EV_*
+  ushort cpu;     // CPU that recorded the event
+  int pid;        // process, or 0
+  int level;      // its queue level (q_lv)
+  int prio;       // its L2 priority
+  int arg;        // event specific
+};
@@ -7,6 +7,7 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "trace.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -60,15 +61,24 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    // Sample what this CPU was doing for the idle statistics.
+    mycpu()->nticks++;
+    if(mycpu()->proc == 0)
+      mycpu()->idleticks++;
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
       //cprintf("INT\n");
       wakeup(&ticks);
       release(&tickslock);
+      boosttick();
     }
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKE:
+    // Only there to end a hlt in scheduler().
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -118,11 +128,19 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->state == RUNNING &&
      tf->trapno == T_IRQ0+IRQ_TIMER) {
 
+      // a boost may have happened while running
+      syncboost(myproc());
+      myproc()->runticks++;
+      if(myproc()->tickets == 0)
+        myproc()->lvticks[myproc()->q_lv]++;
+
       // calculate time quantum
-      myproc()->tq++;
+      // stride processes have none, they yield every tick
+      if(myproc()->tickets == 0)
+        myproc()->tq++;
 
       // check queue level
-      if(myproc()->tq == (myproc()->q_lv)*2 + 4) {
+      if(myproc()->tickets == 0 && myproc()->tq == (myproc()->q_lv)*2 + 4) {
 
         // if L2, change priority
         if(myproc()->q_lv == 2) {
@@ -134,8 +152,11 @@ trap(struct trapframe *tf)
 
         // make tq == 0
         myproc()->tq = 0;
+        myproc()->ndemote++;
+        trace(EV_DEMOTE, myproc(), 0);
       }
       
+      myproc()->nivcsw++;
       yield();
      }
 
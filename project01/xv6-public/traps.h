@@ -34,6 +34,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_WAKE        20      // IPI that wakes a halted CPU
 #define IRQ_SPURIOUS    31
 
 #define prac            128
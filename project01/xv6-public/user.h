@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct schedevent;
+struct pstat;
 
 // system calls
 int fork(void);
@@ -29,6 +31,12 @@ void yield(void);
 int getLevel(void);
 void schedulerLock(int);
 void schedulerUnlock(int);
+int schedtrace(struct schedevent*, int);
+int getpstat(struct pstat*, int);
+int setTickets(int, int);
+int setStrideShare(int);
+int setaffinity(int, int);
+int getaffinity(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -0,0 +1,108 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// fork() cost for a process with a big heap. With copy-on-write,
+// fork+exec and fork+exit should hardly depend on the heap size;
+// only a child that writes the whole heap pays for copying it:
+//   $ cow_bench [heapMB] [rounds]
+// Compare heapMB = 1 against heapMB = 16.
+
+#define HEAP_MB 8
+#define NUM_ROUND 20
+#define PAGE 4096
+
+char *heap;
+int npage;
+
+void
+touch(int val)
+{
+  int i;
+
+  for (i = 0; i < npage; i++)
+    heap[i * PAGE] = val;
+}
+
+// Fork rounds times, run child(), and wait each time.
+int
+run(char *name, void (*child)(void), int rounds)
+{
+  int i, pid, t0, t;
+
+  t0 = uptime();
+  for (i = 0; i < rounds; i++) {
+    pid = fork();
+    if (pid < 0) {
+      printf(1, "cow_bench: fork failed\n");
+      exit();
+    }
+    if (pid == 0) {
+      child();
+      exit();
+    }
+    wait();
+  }
+  t = uptime() - t0;
+  printf(1, "%s: %d rounds in %d ticks\n", name, rounds, t);
+  return t;
+}
+
+void
+doexec(void)
+{
+  char *args[] = { "/cow_bench", "child", 0 };
+
+  exec(args[0], args);
+  printf(1, "cow_bench: exec failed\n");
+}
+
+void
+doexit(void)
+{
+}
+
+void
+dowrite(void)
+{
+  touch(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = HEAP_MB;
+  int rounds = NUM_ROUND;
+  int i, bad;
+
+  if (argc > 1 && strcmp(argv[1], "child") == 0)
+    exit();
+  if (argc > 1)
+    mb = atoi(argv[1]);
+  if (argc > 2)
+    rounds = atoi(argv[2]);
+  if (mb <= 0 || rounds <= 0) {
+    printf(1, "usage: cow_bench [heapMB] [rounds]\n");
+    exit();
+  }
+
+  npage = mb * 1024 * 1024 / PAGE;
+  heap = sbrk(npage * PAGE);
+  if (heap == (char *)-1) {
+    printf(1, "cow_bench: sbrk failed\n");
+    exit();
+  }
+  touch(1);
+  printf(1, "cow_bench: %d MB heap\n", mb);
+
+  run("fork+exec ", doexec, rounds);
+  run("fork+exit ", doexit, rounds);
+  run("fork+write", dowrite, rounds);
+
+  // The children's writes must not show through.
+  for (i = 0, bad = 0; i < npage; i++)
+    if (heap[i * PAGE] != 1)
+      bad++;
+  printf(1, "cow_bench: parent heap %s\n", bad ? "CORRUPTED" : "ok");
+  exit();
+}
@@ -4,6 +4,8 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct pstat;
+struct memstat;
 struct thread;
 struct rtcdate;
 struct spinlock;
@@ -68,6 +70,11 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kref(char*);
+int             krefcount(char*);
+char*           kallocblk(int);
+void            kfreeblk(char*, int);
+void            kmemstat(struct memstat*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -80,6 +87,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -114,6 +122,9 @@ struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+int             getpstat(struct pstat*, int);
+int             setaffinity(int, int);
+int             getaffinity(int);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -121,15 +132,34 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeup1(void*);
 void            yield(void);
-void            copy_thread(struct proc*, struct thread*);
-void            copy_process(struct proc*, struct thread*);
+void            wakethread(struct thread*);
+struct thread*  mythread(void);
+struct thread*  allocthread(struct proc*);
+struct thread*  findthread(struct proc*, thread_t);
+void            freethread(struct thread*);
+int             freestack(struct thread*);
+int             retirethread(struct thread*);
+struct spinlock* vmlock(struct proc*);
+int             addsrange(struct proc*, uint, uint);
+uint            takesrange(struct proc*, uint);
+int             threadstacksize(int);
+int             killsiblings(void);
+struct thread*  solothread(void);
+void            tlbshootdown(struct proc*);
+int             faultin(struct proc*, uint, int);
+int             pagefault(uint, uint);
+int             prefault(uint, uint, int);
+int             futexwait(uint, int);
+int             futexwake(uint, int);
 int             setmemorylimit(int, int);
 
 // thread.c
-int             thread_create(thread_t*, void *(*)(void*), void*);
+int             thread_create(thread_t*, void *(*)(void*), void*, uint);
 void            thread_exit(void*);
 int             thread_join(thread_t, void**);
+int             thread_join_any(thread_t*, void**);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -149,6 +179,12 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// slab.c
+void            kmallocinit(void);
+void*           kmalloc(uint);
+void            kmfree(void*);
+void            kmallocstat(struct memstat*);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -161,6 +197,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -185,13 +222,16 @@ void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
+int             uvaready(pde_t*, char*, int);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
-void            switchuvm(struct proc*);
+int             cowcopy(pde_t*, uint);
+int             mapzero(pde_t*, uint);
+void            switchuvm(struct thread*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
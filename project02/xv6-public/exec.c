@@ -19,6 +19,7 @@ exec(char *path, char **argv)
   pde_t *pgdir;
   pde_t *oldpgdir;
   struct proc *curproc = myproc();
+  struct thread *t;
 
   begin_op();
 
@@ -106,68 +107,27 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
+  // Leave the calling thread the only one, as the main thread.
+  if((t = solothread()) == 0)
+    goto bad;
+
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
-  pushcli();
-
-  // 1. 지금까지 실행되던 모든 쓰레드를 종료하고 exec를 호출한 thread 하나만 남게 해야합니다.
-  struct thread *t;
-  struct thread *exec_call_thread = 0;
-  for(int i=9; i>=0; i--) {
-    t = &(curproc->ttable[i]);
-    if(t->state == UNUSED) continue;
-
-    // 1-1. 붙여넣을 thread, 즉 exec를 호출한 thread는 남겨둡니다.
-    if(t->tid == curproc->cur_thread) {
-      exec_call_thread = t;
-      continue;
-    }
-
-    kfree(t->kstack);
-    t->kstack = 0;
-    t->tf = 0;
-    t->context = 0;
-    t->state = UNUSED;
-    t->tid = 0;
-    t->chan = 0;    
-  }
-
-  t = &(curproc->ttable[0]);
-
-  // 2. main_thread의 위치로 thread를 옮겨주어야 합니다.
-
-  if(exec_call_thread->tid != 0) {
-    t->kstack = exec_call_thread->kstack;
-    t->tf = exec_call_thread->tf;
-    t->context = exec_call_thread->context;
-    t->tid = 0;
-
-    exec_call_thread->kstack = 0;
-    exec_call_thread->tf = 0;
-    exec_call_thread->context = 0;
-    exec_call_thread->state = UNUSED;
-    exec_call_thread->tid = 0;
-  }
-
-  curproc->cur_thread = 0;
-  t->state = RUNNABLE;
-
   // Commit to the user image.
-  // 3. proc 구조체 안에 정보롤 저장합니다.
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
-  curproc->tf->eip = elf.entry;
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
+  t->tf->eip = elf.entry;
+  t->tf->esp = sp;
+  t->tf->gs = 0;
+  t->tls = 0;
+  switchuvm(t);
   freevm(oldpgdir);
 
-  popcli();
-
   return 0;
 
  bad:
@@ -192,6 +152,7 @@ exec2(char *path, char **argv, int stacksize)
   pde_t *pgdir;
   pde_t *oldpgdir;
   struct proc *curproc = myproc();
+  struct thread *t;
 
   if(stacksize > 100) {
     cprintf("ERROR : stacksize bigger than 100\n");
@@ -287,65 +248,27 @@ exec2(char *path, char **argv, int stacksize)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
+  // Leave the calling thread the only one, as the main thread.
+  if((t = solothread()) == 0)
+    goto bad;
+
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
-  pushcli();
-
-  // exec를 하면 지금까지 실행되던 모든 쓰레드를 종료하고 하나만 남게 해야합니다.
-  struct thread *t;
-  struct thread *exec_call_thread = 0;
-  for(int i=9; i>=0; i--) {
-    t = &(curproc->ttable[i]);
-    if(t->state == UNUSED) continue;
-    if(t->tid == curproc->cur_thread) {
-      exec_call_thread = t;
-      continue;
-    }
-
-    kfree(t->kstack);
-    t->kstack = 0;
-    t->tf = 0;
-    t->context = 0;
-    t->state = UNUSED;
-    t->tid = 0;
-    t->chan = 0;    
-  }
-
-  t = &(curproc->ttable[0]);
-
-  // 2. main_thread의 위치로 thread를 옮겨주어야 합니다.
-
-  if(exec_call_thread->tid != 0) {
-    t->kstack = exec_call_thread->kstack;
-    t->tf = exec_call_thread->tf;
-    t->context = exec_call_thread->context;
-    t->tid = 0;
-
-    exec_call_thread->kstack = 0;
-    exec_call_thread->tf = 0;
-    exec_call_thread->context = 0;
-    exec_call_thread->state = UNUSED;
-    exec_call_thread->tid = 0;
-  }
-  
-  curproc->cur_thread = 0;
-  t->state = RUNNABLE;
-
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
-  curproc->tf->eip = elf.entry;
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
+  t->tf->eip = elf.entry;
+  t->tf->esp = sp;
+  t->tf->gs = 0;
+  t->tls = 0;
+  switchuvm(t);
   freevm(oldpgdir);
 
-  popcli();
-
   return 0;
 
  bad:
@@ -11,9 +11,10 @@
 #include "file.h"
 
 struct devsw devsw[NDEV];
+// Files come from kmalloc, so there is no system-wide limit;
+// the lock guards their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
 } ftable;
 
 void
@@ -28,16 +29,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmalloc(sizeof(*f))) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -66,9 +62,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmfree(f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
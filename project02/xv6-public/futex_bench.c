@@ -0,0 +1,100 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Lock contention benchmark: nthreads threads of one process take
+// turns on one lock around a short critical section, first with a
+// lock that spins and yields, then with the usync.c mutex, which
+// sleeps in the kernel only when contended.
+//   make qemu CPUS=4
+//   $ futex_bench [nthreads] [iters]
+
+#define MAX_WORKER 32  // threads besides the main one
+#define NUM_THREAD 4
+#define NUM_ITER 20000
+
+enum { SPIN, FUTEX };
+
+int mode;
+int iters;
+volatile int lock;
+mutex_t mutex;
+volatile int counter;
+
+// Spin-yield lock: 0 free, 1 held.
+void
+spin_lock(volatile int *l)
+{
+  while (__sync_lock_test_and_set(l, 1) != 0)
+    yield();
+}
+
+void
+spin_unlock(volatile int *l)
+{
+  __sync_lock_release(l);
+}
+
+void*
+worker(void *arg)
+{
+  int i, j;
+
+  for (i = 0; i < iters; i++) {
+    if (mode == SPIN)
+      spin_lock(&lock);
+    else
+      mutex_lock(&mutex);
+    for (j = 0; j < 10; j++)
+      counter++;
+    if (mode == SPIN)
+      spin_unlock(&lock);
+    else
+      mutex_unlock(&mutex);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void
+run(char *name, int m, int nthread)
+{
+  thread_t thread[MAX_WORKER];
+  void *retval;
+  int i, n, start, elapsed;
+
+  mode = m;
+  lock = 0;
+  mutex_init(&mutex);
+  counter = 0;
+  start = uptime();
+  for (i = 0, n = 0; i < nthread; i++)
+    if (thread_create(&thread[n], worker, 0) == 0)
+      n++;
+  for (i = 0; i < n; i++)
+    thread_join(thread[i], &retval);
+  elapsed = uptime() - start;
+
+  printf(1, "futex_bench: %s %d threads, %d ticks%s\n", name, n, elapsed,
+         counter == n * iters * 10 ? "" : ", COUNTER WRONG");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nthread = NUM_THREAD;
+
+  iters = NUM_ITER;
+  if (argc > 1)
+    nthread = atoi(argv[1]);
+  if (argc > 2)
+    iters = atoi(argv[2]);
+  if (nthread <= 0 || nthread > MAX_WORKER || iters <= 0) {
+    printf(1, "usage: futex_bench [1-%d] [iters]\n", MAX_WORKER);
+    exit();
+  }
+
+  run("spin-yield", SPIN, nthread);
+  run("futex", FUTEX, nthread);
+  exit();
+}
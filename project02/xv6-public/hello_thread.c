@@ -2,8 +2,102 @@
 #include "stat.h"
 #include "user.h"
 
+// Run with no arguments (as thread_test execs it) to say hello.
+// "hello_thread bench [nthreads]" times a read-mostly workload on a
+// shared table, guarded first by a mutex and then by a reader-writer
+// lock; with several CPUs the readers should overlap under the latter:
+//   make qemu CPUS=4
+//   $ hello_thread bench 4
+
+#define MAX_WORKER 32  // threads besides the main one
+#define BENCH_ITER 20000
+#define NUM_SLOT 16
+
+enum { MUTEX, RWLOCK };
+
+int mode;
+mutex_t mutex;
+rwlock_t rwlock;
+barrier_t start;
+volatile int table[NUM_SLOT];
+volatile int sum;
+
+void *bench_main(void *arg)
+{
+  int id = (int)arg;
+  int i, j, s;
+
+  barrier_wait(&start);
+  for (i = 0; i < BENCH_ITER; i++) {
+    // One write for every 16 reads.
+    if (i % 16 == id % 16) {
+      if (mode == MUTEX)
+        mutex_lock(&mutex);
+      else
+        rwlock_wrlock(&rwlock);
+      table[i % NUM_SLOT]++;
+      if (mode == MUTEX)
+        mutex_unlock(&mutex);
+      else
+        rwlock_wrunlock(&rwlock);
+    } else {
+      if (mode == MUTEX)
+        mutex_lock(&mutex);
+      else
+        rwlock_rdlock(&rwlock);
+      for (j = 0, s = 0; j < NUM_SLOT; j++)
+        s += table[j];
+      sum = s;
+      if (mode == MUTEX)
+        mutex_unlock(&mutex);
+      else
+        rwlock_rdunlock(&rwlock);
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void run(char *name, int m, int nthread)
+{
+  thread_t thread[MAX_WORKER];
+  void *retval;
+  int i, t0;
+
+  mode = m;
+  mutex_init(&mutex);
+  rwlock_init(&rwlock);
+  // The main thread starts the clock once all workers exist.
+  barrier_init(&start, nthread + 1);
+  for (i = 0; i < nthread; i++) {
+    if (thread_create(&thread[i], bench_main, (void *)i) != 0) {
+      printf(1, "hello_thread: thread_create failed\n");
+      exit();
+    }
+  }
+  barrier_wait(&start);
+  t0 = uptime();
+  for (i = 0; i < nthread; i++)
+    thread_join(thread[i], &retval);
+  printf(1, "hello_thread bench: %s %d threads, %d ticks\n",
+         name, nthread, uptime() - t0);
+}
+
 int main(int argc, char *argv[])
 {
+  int nthread;
+
+  if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+    nthread = argc > 2 ? atoi(argv[2]) : 4;
+    if (nthread <= 0 || nthread > MAX_WORKER) {
+      printf(1, "usage: hello_thread bench [1-%d]\n", MAX_WORKER);
+      exit();
+    }
+    run("mutex", MUTEX, nthread);
+    run("rwlock", RWLOCK, nthread);
+    exit();
+  }
+
   printf(1, "Hello, thread!\n");
   exit();
 }
@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and blocks of
+// 2^order contiguous pages for callers that need them.
 
 #include "types.h"
 #include "defs.h"
@@ -8,21 +9,53 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "memstat.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+// kmem is a buddy allocator. A free block of order k is 2^k pages
+// whose physical address is a multiple of its size; it sits on
+// free[k], and its buddy is the block whose address differs only in
+// bit k. Freeing a block whose buddy is free too merges the two into
+// one of order k+1, and so on up to MAXORDER.
+#define MAXORDER (NKORDER-1)
+#define NPAGE (PHYSTOP/PGSIZE)
+#define PGFREE 0x80  // pgstate: first page of a free block
+
 struct run {
   struct run *next;
+  struct run *prev;  // kmem lists only
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[NKORDER];  // list heads
+  uint nfree[NKORDER];
+  uchar pgstate[NPAGE];      // PGFREE|order for a free block's first page
+  ushort pgref[NPAGE];       // page tables mapping each kalloc() page
 } kmem;
 
+// Each CPU keeps a few free pages of its own, so that most kalloc()
+// and kfree() calls take only a lock no other CPU is touching. It
+// refills from kmem, and drains back to it, KBATCH pages at a time.
+// Interrupts are off while a CPU uses its cache; the lock is there
+// for kalloc() on a CPU that finds kmem empty and steals pages.
+// Cached pages count as allocated in kmem.
+#define KBATCH 16
+#define KBATCHORDER 4  // KBATCH == 1<<KBATCHORDER
+#define KCACHEMAX (2*KBATCH)
+
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+};
+
+struct kcache kcache[NCPU];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +64,13 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i <= MAXORDER; i++)
+    kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
+  for(i = 0; i < NCPU; i++)
+    initlock(&kcache[i].lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -51,6 +90,134 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+static void
+listadd(int order, struct run *r)
+{
+  struct run *h = &kmem.free[order];
+
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  kmem.pgstate[V2P(r)/PGSIZE] = PGFREE | order;
+  kmem.nfree[order]++;
+}
+
+static void
+listdel(int order, struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.pgstate[V2P(r)/PGSIZE] = 0;
+  kmem.nfree[order]--;
+}
+
+// Take a block of 2^order pages from kmem, splitting a bigger one
+// if need be. kmem.lock must be held once use_lock is set.
+static struct run*
+buddyalloc(int order)
+{
+  struct run *r;
+  int o;
+
+  for(o = order; o <= MAXORDER; o++)
+    if(kmem.free[o].next != &kmem.free[o])
+      break;
+  if(o > MAXORDER)
+    return 0;
+  r = kmem.free[o].next;
+  listdel(o, r);
+  // Give back the upper halves we do not need.
+  while(o > order){
+    o--;
+    listadd(o, (struct run*)((char*)r + (PGSIZE << o)));
+  }
+  return r;
+}
+
+// Give a block of 2^order pages back to kmem, merging it with its
+// buddy while that is free. kmem.lock must be held once use_lock
+// is set.
+static void
+buddyfree(char *v, int order)
+{
+  uint pa, bpa;
+
+  pa = V2P(v);
+  for(; order < MAXORDER; order++){
+    bpa = pa ^ (PGSIZE << order);
+    if(bpa >= PHYSTOP || kmem.pgstate[bpa/PGSIZE] != (PGFREE | order))
+      break;
+    listdel(order, (struct run*)P2V(bpa));
+    pa &= ~(PGSIZE << order);
+  }
+  listadd(order, (struct run*)P2V(pa));
+}
+
+// Move up to n pages from kmem to cache c. Returns how many moved.
+static int
+refill(struct kcache *c, int n)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  // One block split here is cheaper than n trips through buddyalloc.
+  if(n == KBATCH && (r = buddyalloc(KBATCHORDER)) != 0){
+    for(i = 0; i < n; i++){
+      ((struct run*)((char*)r + i*PGSIZE))->next = c->freelist;
+      c->freelist = (struct run*)((char*)r + i*PGSIZE);
+    }
+  } else {
+    for(i = 0; i < n && (r = buddyalloc(0)) != 0; i++){
+      r->next = c->freelist;
+      c->freelist = r;
+    }
+  }
+  release(&kmem.lock);
+  c->n += i;
+  return i;
+}
+
+// Move n pages from cache c back to kmem.
+static void
+drain(struct kcache *c, int n)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < n && (r = c->freelist) != 0; i++){
+    c->freelist = r->next;
+    buddyfree((char*)r, 0);
+  }
+  release(&kmem.lock);
+  c->n -= i;
+}
+
+// kmem is empty: take a page from another CPU's cache.
+static struct run*
+steal(struct kcache *mine)
+{
+  struct kcache *c;
+  struct run *r;
+
+  for(c = kcache; c < &kcache[NCPU]; c++){
+    if(c == mine)
+      continue;
+    acquire(&c->lock);
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->n--;
+    }
+    release(&c->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -60,20 +227,36 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
+  ushort *ref;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // A page shared copy-on-write is only freed by its last user.
+  ref = &kmem.pgref[V2P(v)/PGSIZE];
+  if(*ref > 1 && __sync_sub_and_fetch(ref, 1) > 0)
+    return;
+  *ref = 0;
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    buddyfree(v, 0);
+    return;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->n > KCACHEMAX)
+    drain(c, KBATCH);
+  release(&c->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +266,113 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    if((r = buddyalloc(0)) != 0)
+      kmem.pgref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  acquire(&c->lock);
+  if(c->freelist == 0)
+    refill(c, KBATCH);
+  if((r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->n--;
+  }
+  release(&c->lock);
+  if(r == 0)
+    r = steal(c);
+  popcli();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    kmem.pgref[V2P(r)/PGSIZE] = 1;
   return (char*)r;
 }
 
+// Count another page table mapping page v, which kalloc() returned.
+void
+kref(char *v)
+{
+  __sync_fetch_and_add(&kmem.pgref[V2P(v)/PGSIZE], 1);
+}
+
+// Return how many page tables map page v.
+int
+krefcount(char *v)
+{
+  return kmem.pgref[V2P(v)/PGSIZE];
+}
+
+// Allocate 2^order physically contiguous pages, aligned to their
+// size. Returns 0 if there is no such block free.
+char*
+kallocblk(int order)
+{
+  struct kcache *c;
+  struct run *r;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  r = buddyalloc(order);
+  release(&kmem.lock);
+  if(r)
+    return (char*)r;
+
+  // Pages held in the per-CPU caches may be what keeps blocks
+  // from merging; hand them all back and try once more.
+  for(c = kcache; c < &kcache[NCPU]; c++){
+    acquire(&c->lock);
+    drain(c, c->n);
+    release(&c->lock);
+  }
+  acquire(&kmem.lock);
+  r = buddyalloc(order);
+  release(&kmem.lock);
+  return (char*)r;
+}
+
+// Free a block that kallocblk(order) returned.
+void
+kfreeblk(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfreeblk");
+
+  memset(v, 1, PGSIZE << order);
+
+  acquire(&kmem.lock);
+  buddyfree(v, order);
+  release(&kmem.lock);
+}
+
+// Fill in *ms. The per-CPU counts are read without their locks,
+// so they may be slightly off.
+void
+kmemstat(struct memstat *ms)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  ms->nfreepages = 0;
+  for(i = 0; i <= MAXORDER; i++){
+    ms->nfree[i] = kmem.nfree[i];
+    ms->nfreepages += kmem.nfree[i] << i;
+  }
+  release(&kmem.lock);
+  ms->ncached = 0;
+  for(i = 0; i < NCPU; i++)
+    ms->ncached += kcache[i].n;
+  ms->nfreepages += ms->ncached;
+}
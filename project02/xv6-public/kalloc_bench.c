@@ -0,0 +1,109 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Page allocator stress. nprocs processes run side by side, first
+// forking and exec'ing a trivial child over and over (page tables,
+// kernel stacks, user pages), then growing and shrinking their
+// memory with sbrk. Every page comes from kalloc() and goes back
+// through kfree(), so with several CPUs this mostly measures how
+// well those scale:
+//   make qemu CPUS=4
+//   $ kalloc_bench 4
+
+#define NUM_PROC 4
+#define NUM_ROUND 50
+#define SBRK_PAGES 64
+#define SBRK_ROUND 200
+
+void
+forkexec(int rounds)
+{
+  char *args[] = { "/kalloc_bench", "child", 0 };
+  int i, pid;
+
+  for (i = 0; i < rounds; i++) {
+    pid = fork();
+    if (pid < 0) {
+      printf(1, "kalloc_bench: fork failed\n");
+      exit();
+    }
+    if (pid == 0) {
+      exec(args[0], args);
+      printf(1, "kalloc_bench: exec failed\n");
+      exit();
+    }
+    wait();
+  }
+}
+
+void
+grow(int rounds)
+{
+  char *p;
+  int i, j;
+
+  for (i = 0; i < rounds; i++) {
+    p = sbrk(SBRK_PAGES * 4096);
+    if (p == (char *)-1) {
+      printf(1, "kalloc_bench: sbrk failed\n");
+      exit();
+    }
+    for (j = 0; j < SBRK_PAGES; j++)
+      p[j * 4096] = j;
+    sbrk(-SBRK_PAGES * 4096);
+  }
+}
+
+// Run f(rounds) in nproc processes at once; return elapsed ticks.
+int
+run(void (*f)(int), int nproc, int rounds)
+{
+  int i, t0, pid;
+
+  t0 = uptime();
+  for (i = 0; i < nproc; i++) {
+    pid = fork();
+    if (pid < 0) {
+      printf(1, "kalloc_bench: fork failed\n");
+      break;
+    }
+    if (pid == 0) {
+      f(rounds);
+      exit();
+    }
+  }
+  while (wait() != -1);
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = NUM_PROC;
+  int rounds = NUM_ROUND;
+  int t;
+
+  if (argc > 1 && strcmp(argv[1], "child") == 0)
+    exit();
+  if (argc > 1)
+    nproc = atoi(argv[1]);
+  if (argc > 2)
+    rounds = atoi(argv[2]);
+  if (nproc <= 0 || rounds <= 0) {
+    printf(1, "usage: kalloc_bench [nprocs] [rounds]\n");
+    exit();
+  }
+
+  printf(1, "kalloc_bench: %d procs\n", nproc);
+
+  t = run(forkexec, nproc, rounds);
+  printf(1, "fork+exec: %d x %d in %d ticks, %d per 100 ticks\n",
+         nproc, rounds, t, nproc * rounds * 100 / (t ? t : 1));
+
+  t = run(grow, nproc, SBRK_ROUND);
+  printf(1, "sbrk %d pages: %d x %d in %d ticks, %d per 100 ticks\n",
+         SBRK_PAGES, nproc, SBRK_ROUND, t,
+         nproc * SBRK_ROUND * 100 / (t ? t : 1));
+  exit();
+}
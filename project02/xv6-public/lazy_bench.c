@@ -0,0 +1,108 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+// Large, sparsely used allocations. sbrk only reserves memory and
+// pages are mapped on first touch, so reserving should cost next to
+// nothing, and the memory used should follow the pages touched
+// rather than the size asked for:
+//   $ lazy_bench [MB] [stride]
+// touches one page in every stride, first of a raw sbrk region and
+// then of a block from malloc.
+
+#define SIZE_MB 64
+#define STRIDE 64
+#define PAGE 4096
+
+int
+freepages(void)
+{
+  struct memstat ms;
+
+  memstat(&ms);
+  return ms.nfreepages;
+}
+
+// Touch every stride-th page of n pages at p; return how many.
+int
+touch(char *p, int n, int stride)
+{
+  int i, t = 0;
+
+  for (i = 0; i < n; i += stride, t++)
+    p[i * PAGE] = i;
+  return t;
+}
+
+// Each touched page must hold what was written, and the page after
+// it, if untouched, must read as zero.
+int
+check(char *p, int n, int stride)
+{
+  int i;
+
+  for (i = 0; i < n; i += stride) {
+    if (p[i * PAGE] != (char)i)
+      return -1;
+    if (stride > 1 && i + 1 < n && p[(i + 1) * PAGE] != 0)
+      return -1;
+  }
+  return 0;
+}
+
+void
+run(char *name, char *(*get)(uint), int mb, int stride)
+{
+  int npage, free0, t0, treserve, ttouch, touched;
+  char *p;
+
+  npage = mb * 1024 * 1024 / PAGE;
+  free0 = freepages();
+  t0 = uptime();
+  p = get(npage * PAGE);
+  treserve = uptime() - t0;
+  if (p == 0 || p == (char *)-1) {
+    printf(1, "lazy_bench: %s of %d MB failed\n", name, mb);
+    return;
+  }
+  t0 = uptime();
+  touched = touch(p, npage, stride);
+  ttouch = uptime() - t0;
+  printf(1, "%s %d MB: reserve %d ticks, touch %d pages %d ticks, "
+         "%d pages used\n", name, mb, treserve, touched, ttouch,
+         free0 - freepages());
+  if (check(p, npage, stride) < 0)
+    printf(1, "lazy_bench: %s memory has bad contents\n", name);
+}
+
+char *
+bysbrk(uint n)
+{
+  return sbrk(n);
+}
+
+char *
+bymalloc(uint n)
+{
+  return malloc(n);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = SIZE_MB;
+  int stride = STRIDE;
+
+  if (argc > 1)
+    mb = atoi(argv[1]);
+  if (argc > 2)
+    stride = atoi(argv[2]);
+  if (mb <= 0 || stride <= 0) {
+    printf(1, "usage: lazy_bench [MB] [stride]\n");
+    exit();
+  }
+  run("sbrk  ", bysbrk, mb, stride);
+  run("malloc", bymalloc, mb, stride);
+  exit();
+}
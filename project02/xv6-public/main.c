@@ -29,6 +29,7 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  kmallocinit();   // small object allocator
   fileinit();      // file table
   ideinit();       // disk 
   startothers();   // start other processors
@@ -0,0 +1,38 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+// Show free physical memory by buddy block size:
+//   $ memstat
+// For each order, unusable is the share of free pages that lie in
+// blocks too small for an allocation of that order; it grows as
+// memory fragments. Then, for each kmalloc size class, the pages
+// it holds and the objects allocated from them.
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat ms;
+  uint free, big;
+  int i, j;
+
+  if (memstat(&ms) < 0) {
+    printf(1, "memstat: failed\n");
+    exit();
+  }
+  free = ms.nfreepages - ms.ncached;
+  printf(1, "free pages %d (%d KB), %d in per-CPU caches\n",
+         ms.nfreepages, ms.nfreepages * 4, ms.ncached);
+  printf(1, "order\tpages\tblocks\tunusable\n");
+  for (i = 0; i < NKORDER; i++) {
+    for (j = i, big = 0; j < NKORDER; j++)
+      big += ms.nfree[j] << j;
+    printf(1, "%d\t%d\t%d\t%d%%\n", i, 1 << i, ms.nfree[i],
+           free ? (free - big) * 100 / free : 0);
+  }
+  printf(1, "kmalloc\tpages\tobjects\n");
+  for (i = 0; i < NKMCLASS; i++)
+    printf(1, "%d\t%d\t%d\n", ms.kmsize[i], ms.kmslabs[i], ms.kminuse[i]);
+  exit();
+}
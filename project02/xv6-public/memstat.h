@@ -0,0 +1,14 @@
+// Free physical memory and kmalloc use, as copied out by the
+// memstat system call.
+
+#define NKORDER 11       // block orders kalloc.c manages: 1 to 1024 pages
+#define NKMCLASS 8       // kmalloc size classes in slab.c
+
+struct memstat {
+  uint nfree[NKORDER];   // free blocks of 2^order pages in the buddy lists
+  uint ncached;          // free pages held in per-CPU caches
+  uint nfreepages;       // all free pages, cached or not
+  uint kmsize[NKMCLASS]; // object size of each kmalloc class
+  uint kmslabs[NKMCLASS];// pages it holds
+  uint kminuse[NKMCLASS];// objects allocated from it
+};
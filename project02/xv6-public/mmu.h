@@ -17,9 +17,10 @@
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_UTLS  6  // this thread's TLS block, reached through %gs
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
@@ -95,6 +96,12 @@ struct segdesc {
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x200   // Copy-on-write (bit left to software)
+
+// Page fault error code bits
+#define FEC_PR          0x001   // Page was present: a protection fault
+#define FEC_WR          0x002   // Fault was a write
+#define FEC_U           0x004   // Fault was in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
@@ -1,8 +1,13 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define NTHREAD      64  // maximum number of threads per process
+#define MAXTHREAD   256  // maximum number of threads in the system
+#define TSTACKPAGES   1  // default user stack pages of a new thread
+#define MAXTSTACK    64  // maximum user stack pages of a thread
+#define NSTACKCACHE   4  // freed thread stacks a process keeps mapped
+#define NSRANGE       8  // freed thread stack ranges a process remembers
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
@@ -10,5 +15,5 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks
 
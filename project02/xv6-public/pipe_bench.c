@@ -0,0 +1,154 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+// Pipe ping-pong latency with idle sleepers present.
+// Every round trip is two pipe writes and two wakeups; without
+// channel-hashed sleep queues each wakeup scans every process.
+//   $ pipe_bench [nsleepers] [rounds]
+// Compare nsleepers = 0 against nsleepers = 60.
+// With CPUS=1 and no sleepers, ticks per round trip is the cost of
+// four context switches.
+// "pipe_bench mem [nprocs]" has nprocs processes hold PIPE_PER_PROC
+// pipes each and reports the kernel memory they take per pipe;
+// it was a whole page before pipes came from kmalloc.
+
+#define NUM_SLEEPER 60
+#define NUM_ROUND 10000
+#define PIPE_PER_PROC 5  // what NOFILE 16 leaves room for
+
+// Pages held by kmalloc.
+int
+slabpages(void)
+{
+  struct memstat ms;
+  int i, n = 0;
+
+  memstat(&ms);
+  for (i = 0; i < NKMCLASS; i++)
+    n += ms.kmslabs[i];
+  return n;
+}
+
+void
+mem(int nproc)
+{
+  int idle[2], ready[2], fd[2];
+  int i, n, pid, npipe, before, after;
+  char c = 0;
+
+  if (nproc <= 0) {
+    printf(1, "usage: pipe_bench mem [nprocs]\n");
+    exit();
+  }
+  if (pipe(idle) < 0 || pipe(ready) < 0) {
+    printf(1, "pipe_bench: pipe failed\n");
+    exit();
+  }
+  before = slabpages();
+  for (n = 0; n < nproc; n++) {
+    pid = fork();
+    if (pid < 0)
+      break;
+    if (pid == 0) {
+      close(idle[1]);
+      close(ready[0]);
+      for (i = 0; i < PIPE_PER_PROC; i++)
+        if (pipe(fd) < 0)
+          break;
+      c = i;
+      write(ready[1], &c, 1);
+      read(idle[0], &c, 1);
+      exit();
+    }
+  }
+  // Each child reports how many pipes it made.
+  for (i = 0, npipe = 0; i < n; i++) {
+    read(ready[0], &c, 1);
+    npipe += c;
+  }
+  after = slabpages();
+  printf(1, "pipe_bench mem: %d pipes take %d pages, %d bytes each (was 4096)\n",
+         npipe, after - before, npipe ? (after - before) * 4096 / npipe : 0);
+  close(idle[1]);
+  while (wait() != -1);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nsleeper = NUM_SLEEPER;
+  int rounds = NUM_ROUND;
+  int idle[2], ping[2], pong[2];
+  int i, n, pid, start, elapsed;
+  char c = 0;
+
+  if (argc > 1 && strcmp(argv[1], "mem") == 0)
+    mem(argc > 2 ? atoi(argv[2]) : 10);
+  if (argc > 1)
+    nsleeper = atoi(argv[1]);
+  if (argc > 2)
+    rounds = atoi(argv[2]);
+  if (nsleeper < 0 || rounds <= 0) {
+    printf(1, "usage: pipe_bench [nsleepers] [rounds]\n");
+    exit();
+  }
+
+  // Sleepers block reading a pipe that is only closed at the end.
+  if (pipe(idle) < 0) {
+    printf(1, "pipe_bench: pipe failed\n");
+    exit();
+  }
+  for (n = 0; n < nsleeper; n++) {
+    pid = fork();
+    if (pid < 0)
+      break;
+    if (pid == 0) {
+      close(idle[1]);
+      read(idle[0], &c, 1);
+      exit();
+    }
+  }
+  close(idle[0]);
+  printf(1, "pipe_bench: %d sleepers, %d round trips\n", n, rounds);
+
+  if (pipe(ping) < 0 || pipe(pong) < 0) {
+    printf(1, "pipe_bench: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if (pid < 0) {
+    printf(1, "pipe_bench: fork failed\n");
+    exit();
+  }
+  if (pid == 0) {
+    for (i = 0; i < rounds; i++) {
+      if (read(ping[0], &c, 1) != 1)
+        break;
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+
+  // give the sleepers time to block
+  sleep(10);
+
+  start = uptime();
+  for (i = 0; i < rounds; i++) {
+    write(ping[1], &c, 1);
+    if (read(pong[0], &c, 1) != 1) {
+      printf(1, "pipe_bench: short read\n");
+      break;
+    }
+  }
+  elapsed = uptime() - start;
+
+  printf(1, "pipe_bench: %d ticks, %d round trips/100 ticks\n",
+         elapsed, elapsed ? i * 100 / elapsed : i * 100);
+
+  close(idle[1]);
+  while (wait() != -1);
+  exit();
+}
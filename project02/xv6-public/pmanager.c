@@ -1,6 +1,27 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+struct pstat ps[NPROC];
+
+// Print scheduling statistics of every process, to spot the ones
+// that starve: wait is ticks spent runnable without a CPU.
+void
+showstat(void)
+{
+  static char *states[] = { "unused", "embryo", "sleep", "runble", "run", "zombie" };
+  int i, n;
+
+  n = getpstat(ps, NPROC);
+  printf(1, "pid\tname\tstate\tthreads\trun\twait\tvcsw\tivcsw\n");
+  for(i = 0; i < n; i++) {
+    printf(1, "%d\t%s\t%s\t%d\t%d\t%d\t%d\t%d\n", ps[i].pid, ps[i].name,
+           states[ps[i].state], ps[i].nthread, ps[i].runticks,
+           ps[i].waitticks, ps[i].nvcsw, ps[i].nivcsw);
+  }
+}
 
 int
 getcmd(char *buf, int nbuf)
@@ -57,6 +78,10 @@ main(int argc, char *argv[])
             procdump();
         
         }
+        else if (strcmp(args[0], "stat") == 0) {
+            printf(1, "Running the stat command\n");
+            showstat();
+        }
         else if (strcmp(args[0], "kill") == 0) {
             if(args[1] != 0) {
                 printf(1, "Running the kill command\n");
@@ -77,15 +102,27 @@ main(int argc, char *argv[])
             char* path = args[1];
             char *val[2] = {path,0};
             uint stacksize = atoi(args[2]);
+            // optional CPU mask to pin the job to
+            int mask = args[3] != 0 ? atoi(args[3]) : 0;
 
             int pid = fork();
 
             if(pid == 0) {
+                if(mask != 0 && setaffinity(getpid(), mask) < 0) printf(1,"ERROR : bad cpu mask %d\n",mask);
                 if(exec2(path,val,stacksize) == -1) printf(1,"ERROR : exec2 fail\n");
                 exit();
                 }
             }
         }
+        else if (strcmp(args[0], "pin") == 0) {
+            if (args[1] != 0 && args[2] != 0) {
+                printf(1, "Running the pin command with pid: %s and mask: %s\n", args[1], args[2]);
+                int pid = atoi(args[1]);
+                int mask = atoi(args[2]);
+                if(setaffinity(pid,mask) == 0) printf(1, "SUCCESS : pid %d on cpus %d\n", pid, getaffinity(pid));
+                else printf(1, "ERROR : pin pid %d\n", pid);
+            }
+        }
         else if (strcmp(args[0], "memlim") == 0) {
 
             if (args[1] != 0 && args[2] != 0) {
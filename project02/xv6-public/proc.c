@@ -6,24 +6,84 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+#include "pstat.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct thread thread[MAXTHREAD];
+  struct thread *freethread;   // UNUSED entries of thread[] no proc keeps
+  struct thread *tidhash[NTIDHASH];
+  // vmlock[i] guards the page table of proc[i] and what faultin()
+  // reads: sz, the user stacks of its threads and which threads it
+  // has, and its freed stack ranges. Changing those takes ptable.lock
+  // and then the vmlock; faultin() only needs the vmlock, so that
+  // page faults and fork() do not hold up the whole machine.
+  struct spinlock vmlock[NPROC];
 } ptable;
 
+// Sleeping threads, hashed by the channel they sleep on, so that
+// wakeup only looks at threads that may be sleeping on its chan.
+// Guarded by ptable.lock.
+#define SLEEPQBITS 6
+#define NSLEEPQ (1 << SLEEPQBITS)
+static struct thread *sleepq[NSLEEPQ];
+
 static struct proc *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
 
 void
 pinit(void)
 {
+  struct thread *t;
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NPROC; i++)
+    initlock(&ptable.vmlock[i], "vm");
+  for(t = ptable.thread; t < &ptable.thread[MAXTHREAD]; t++){
+    t->pnext = ptable.freethread;
+    ptable.freethread = t;
+  }
+}
+
+// The lock guarding p's page table; see ptable.
+struct spinlock*
+vmlock(struct proc *p)
+{
+  return &ptable.vmlock[p - ptable.proc];
+}
+
+// Whether p may run on CPU c.
+static int
+allowed(struct proc *p, struct cpu *c)
+{
+  return (p->affinity >> (c - cpus)) & 1;
+}
+
+// Wake a halted CPU, if any, that may run thread t, which was just
+// made RUNNABLE: the one t last ran on if it can, for a warm cache.
+// Must be called with ptable.lock held; a CPU sets its idle flag
+// before releasing ptable.lock to halt, so we cannot miss it.
+static void
+kick(struct thread *t)
+{
+  struct cpu *c;
+
+  c = t->cpu;
+  if(c == 0 || c == mycpu() || !c->idle || !allowed(t->proc, c)){
+    for(c = cpus; c < cpus+ncpu; c++)
+      if(c != mycpu() && c->idle && allowed(t->proc, c))
+        break;
+    if(c == cpus+ncpu)
+      return;
+  }
+  lapicipi(c->apicid, T_IRQ0 + IRQ_WAKE);
 }
 
 // Must be called with interrupts disabled
@@ -53,16 +113,542 @@ mycpu(void)
 }
 
 // Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
+// while reading thread from the cpu structure
 struct proc*
 myproc(void) {
   struct cpu *c;
-  struct proc *p;
+  struct thread *t;
   pushcli();
   c = mycpu();
-  p = c->proc;
+  t = c->thread;
   popcli();
-  return p;
+  return t ? t->proc : 0;
+}
+
+// The thread running on this CPU, like myproc().
+struct thread*
+mythread(void) {
+  struct cpu *c;
+  struct thread *t;
+  pushcli();
+  c = mycpu();
+  t = c->thread;
+  popcli();
+  return t;
+}
+
+// Sleep queue bucket for chan.
+static struct thread**
+sleepbucket(void *chan)
+{
+  // Fibonacci hashing: the top bits of chan * 2^32/phi.
+  return &sleepq[((uint)chan * 2654435761U) >> (32 - SLEEPQBITS)];
+}
+
+// Put t, which is about to sleep on t->chan, on its sleep queue.
+static void
+sleepqadd(struct thread *t)
+{
+  struct thread **b = sleepbucket(t->chan);
+
+  t->slnext = *b;
+  *b = t;
+}
+
+// Take sleeping t off its sleep queue.
+static void
+sleepqdel(struct thread *t)
+{
+  struct thread **tp;
+
+  for(tp = sleepbucket(t->chan); *tp; tp = &(*tp)->slnext){
+    if(*tp == t){
+      *tp = t->slnext;
+      t->slnext = 0;
+      return;
+    }
+  }
+  panic("sleepqdel");
+}
+
+// Make t RUNNABLE whatever it is sleeping on.
+// The ptable lock must be held.
+void
+wakethread(struct thread *t)
+{
+  if(t->state == SLEEPING)
+    sleepqdel(t);
+  t->state = RUNNABLE;
+  t->readytick = ticks;
+  kick(t);
+}
+
+// Chain of the tid hash for thread tid of p.
+static struct thread**
+tidbucket(struct proc *p, thread_t tid)
+{
+  return &ptable.tidhash[((p - ptable.proc) * 31 + tid) % NTIDHASH];
+}
+
+static void
+hashthread(struct thread *t)
+{
+  struct thread **b = tidbucket(t->proc, t->tid);
+
+  t->hnext = *b;
+  *b = t;
+}
+
+static void
+unhashthread(struct thread *t)
+{
+  struct thread **tp;
+
+  for(tp = tidbucket(t->proc, t->tid); *tp; tp = &(*tp)->hnext){
+    if(*tp == t){
+      *tp = t->hnext;
+      t->hnext = 0;
+      return;
+    }
+  }
+  panic("unhashthread");
+}
+
+// Thread tid of p, or 0 if there is none.
+// The ptable lock must be held.
+struct thread*
+findthread(struct proc *p, thread_t tid)
+{
+  struct thread *t;
+
+  for(t = *tidbucket(p, tid); t; t = t->hnext)
+    if(t->proc == p && t->tid == tid)
+      return t;
+  return 0;
+}
+
+// Give p a new EMBRYO thread whose kernel stack is set up to start
+// in forkret. An UNUSED thread p already has, with a user stack of
+// the size p->tstacksize asks for, is taken first; then a fresh one;
+// then any UNUSED one of p's. Return 0 if p has NTHREAD threads, the
+// thread table is full, or memory is short.
+// The ptable lock and p's vmlock must be held.
+struct thread*
+allocthread(struct proc *p)
+{
+  struct thread *t;
+  char *sp;
+
+  if(p->nthread >= NTHREAD)
+    return 0;
+  for(t = p->threads; t; t = t->pnext)
+    if(t->state == UNUSED && t->start && t->stacksize == p->tstacksize)
+      break;
+  if(t == 0 && (t = ptable.freethread) != 0){
+    ptable.freethread = t->pnext;
+    t->proc = p;
+    t->start = 0;
+    t->stacksize = 0;
+    t->stackmapped = 0;
+    t->pnext = p->threads;
+    p->threads = t;
+  }
+  if(t == 0){
+    for(t = p->threads; t; t = t->pnext)
+      if(t->state == UNUSED)
+        break;
+    if(t == 0)
+      return 0;
+  }
+
+  // Allocate kernel stack.
+  if((t->kstack = kalloc()) == 0)
+    return 0;
+  sp = t->kstack + KSTACKSIZE;
+
+  // Leave room for trap frame.
+  sp -= sizeof *t->tf;
+  t->tf = (struct trapframe*)sp;
+
+  // Set up new context to start executing at forkret,
+  // which returns to trapret.
+  sp -= 4;
+  *(uint*)sp = (uint)trapret;
+
+  sp -= sizeof *t->context;
+  t->context = (struct context*)sp;
+  memset(t->context, 0, sizeof *t->context);
+  t->context->eip = (uint)forkret;
+
+  t->state = EMBRYO;
+  t->tid = p->nexttid++;
+  t->killed = 0;
+  t->cpu = 0;
+  t->tls = 0;
+  hashthread(t);
+  p->nthread++;
+  return t;
+}
+
+// Free the kernel stack of t, which is not running, and mark it
+// UNUSED. It stays on its process's list with its user stack for
+// allocthread() to reuse. The ptable lock must be held.
+void
+freethread(struct thread *t)
+{
+  if(t->state == SLEEPING)
+    sleepqdel(t);
+  unhashthread(t);
+  t->proc->nthread--;
+  kfree(t->kstack);
+  t->kstack = 0;
+  t->tf = 0;
+  t->context = 0;
+  t->chan = 0;
+  t->tid = 0;
+  t->ptid = 0;
+  t->retval = 0;
+  t->killed = 0;
+  t->tls = 0;
+  t->state = UNUSED;
+}
+
+// Take UNUSED thread t off its process's list and give it back
+// to the thread table. The ptable lock must be held.
+static void
+putthread(struct thread *t)
+{
+  struct thread **tp;
+
+  for(tp = &t->proc->threads; *tp != t; tp = &(*tp)->pnext)
+    ;
+  *tp = t->pnext;
+  t->proc = 0;
+  t->start = 0;
+  t->stackmapped = 0;
+  t->pnext = ptable.freethread;
+  ptable.freethread = t;
+}
+
+// Unmap and free the user stack pages of UNUSED thread t, keeping
+// its address range. Return 1 if there were any: the caller must
+// then tlbshootdown() once it has released ptable.lock, which must
+// be held, and the vmlock.
+int
+freestack(struct thread *t)
+{
+  if(t->start == 0 || !t->stackmapped)
+    return 0;
+  deallocuvm(t->proc->pgdir, t->start + PGSIZE + t->stacksize,
+             t->start + PGSIZE);
+  t->stackmapped = 0;
+  return 1;
+}
+
+static void
+delsrange(struct proc *p, int i)
+{
+  p->srange[i] = p->srange[--p->nsrange];
+}
+
+// Remember [start, end) of p as a freed stack range, merged with
+// the ranges next to it. Returns -1 if p has no room for another.
+// The ptable lock and p's vmlock must be held.
+int
+addsrange(struct proc *p, uint start, uint end)
+{
+  int i, l, r;
+
+  l = r = -1;
+  for(i = 0; i < p->nsrange; i++){
+    if(p->srange[i].end == start)
+      l = i;
+    if(p->srange[i].start == end)
+      r = i;
+  }
+  if(l >= 0 && r >= 0){
+    p->srange[l].end = p->srange[r].end;
+    delsrange(p, r);
+  } else if(l >= 0)
+    p->srange[l].end = end;
+  else if(r >= 0)
+    p->srange[r].start = start;
+  else {
+    if(p->nsrange == NSRANGE)
+      return -1;
+    p->srange[p->nsrange].start = start;
+    p->srange[p->nsrange].end = end;
+    p->nsrange++;
+  }
+  return 0;
+}
+
+// Take n bytes from the first of p's freed stack ranges big enough.
+// Return their start, or 0 if there is none.
+// The ptable lock and p's vmlock must be held.
+uint
+takesrange(struct proc *p, uint n)
+{
+  struct srange *r;
+  uint a;
+
+  for(r = p->srange; r < &p->srange[p->nsrange]; r++){
+    if(r->end - r->start < n)
+      continue;
+    a = r->start;
+    r->start += n;
+    if(r->start == r->end)
+      delsrange(p, r - p->srange);
+    return a;
+  }
+  return 0;
+}
+
+// Whether va lies in one of p's freed stack ranges.
+static int
+insrange(struct proc *p, uint va)
+{
+  int i;
+
+  for(i = 0; i < p->nsrange; i++)
+    if(va >= p->srange[i].start && va < p->srange[i].end)
+      return 1;
+  return 0;
+}
+
+// Forget what of p's freed stack ranges lies at or above p->sz,
+// which has just shrunk. The ptable lock and p's vmlock must be held.
+static void
+clipsranges(struct proc *p)
+{
+  int i;
+
+  for(i = p->nsrange - 1; i >= 0; i--){
+    if(p->srange[i].start >= p->sz)
+      delsrange(p, i);
+    else if(p->srange[i].end > p->sz)
+      p->srange[i].end = p->sz;
+  }
+}
+
+// Thread t of p has just been joined. Keep it, with its user stack
+// mapped, for the next thread_create, unless p already keeps
+// NSTACKCACHE; then free the pages, remember the address range for
+// the stacks of later threads, so that churning threads leaves no
+// holes, and give the descriptor back to the thread table. Ranges
+// at the top of p's memory go back outright. Returns as freestack();
+// the ptable lock and p's vmlock must be held.
+int
+retirethread(struct thread *t)
+{
+  struct proc *p = t->proc;
+  struct thread *u;
+  int i, n, shoot, shrunk;
+
+  if(t->start == 0)
+    return 0;
+  n = 0;
+  for(u = p->threads; u; u = u->pnext)
+    if(u != t && u->state == UNUSED && u->start)
+      n++;
+  if(n < NSTACKCACHE)
+    return 0;
+
+  shoot = freestack(t);
+  // With no room for the range, t keeps it, as a cached stack
+  // whose pages are gone.
+  if(addsrange(p, t->start, t->start + PGSIZE + t->stacksize) == 0)
+    putthread(t);
+
+  do {
+    shrunk = 0;
+    for(u = p->threads; u; u = u->pnext){
+      if(u->state == UNUSED && u->start && !u->stackmapped &&
+         u->start + PGSIZE + u->stacksize == p->sz){
+        p->sz = u->start;
+        putthread(u);
+        shrunk = 1;
+        break;
+      }
+    }
+    for(i = 0; i < p->nsrange; i++){
+      if(p->srange[i].end == p->sz){
+        p->sz = p->srange[i].start;
+        delsrange(p, i);
+        shrunk = 1;
+        break;
+      }
+    }
+  } while(shrunk);
+  return shoot;
+}
+
+// Set the user stack size of threads the current process creates
+// from now on to npages, or leave it if npages is 0.
+// Return the old size in pages, or -1 if npages is out of range.
+int
+threadstacksize(int npages)
+{
+  struct proc *p = myproc();
+  int old;
+
+  if(npages < 0 || npages > MAXTSTACK)
+    return -1;
+  acquire(&ptable.lock);
+  old = p->tstacksize / PGSIZE;
+  if(npages > 0)
+    p->tstacksize = npages * PGSIZE;
+  release(&ptable.lock);
+  return old;
+}
+
+// Hand every thread of p but keep back to the thread table, freeing
+// any still in use. The ptable lock must be held.
+static void
+dropthreads(struct proc *p, struct thread *keep)
+{
+  struct thread *t, *next;
+
+  t = p->threads;
+  p->threads = keep;
+  for(; t; t = next){
+    next = t->pnext;
+    if(t == keep){
+      t->pnext = 0;
+      continue;
+    }
+    if(t->state != UNUSED)
+      freethread(t);
+    t->proc = 0;
+    t->start = 0;
+    t->stackmapped = 0;
+    t->pnext = ptable.freethread;
+    ptable.freethread = t;
+  }
+}
+
+// Make every other thread of the current process exit, wait until
+// they have, and free them. They notice t->killed where a killed
+// process would: on their way back to user space or in an
+// interruptible sleep. Used by exit() and exec(), which need the
+// process to themselves.
+// Returns -1 if another thread of the process got there first and
+// is taking this one down; the caller must then exit().
+int
+killsiblings(void)
+{
+  struct proc *p = myproc();
+  struct thread *cur = mythread();
+  struct thread *t;
+  int alive;
+
+  acquire(&ptable.lock);
+  if(p->reaper != 0 && p->reaper != cur){
+    release(&ptable.lock);
+    return -1;
+  }
+  p->reaper = cur;
+
+  for(;;){
+    alive = 0;
+    for(t = p->threads; t; t = t->pnext){
+      if(t == cur || t->state == UNUSED)
+        continue;
+      if(t->state == ZOMBIE){
+        freethread(t);
+        continue;
+      }
+      t->killed = 1;
+      if(t->state == SLEEPING)
+        wakethread(t);
+      alive = 1;
+    }
+    if(!alive)
+      break;
+    // A dying sibling wakes us from exit().
+    sleep(cur, &ptable.lock);
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Leave the calling thread the only one of its process and make it
+// the main thread, for exec(). Returns that thread, or 0 if another
+// thread is taking the process down.
+struct thread*
+solothread(void)
+{
+  struct proc *p = myproc();
+  struct thread *cur = mythread();
+
+  if(killsiblings() < 0)
+    return 0;
+
+  acquire(&ptable.lock);
+  acquire(vmlock(p));
+  // The others' user stacks go away with the old page table,
+  // and so does ours.
+  dropthreads(p, cur);
+  p->nsrange = 0;
+  cur->start = 0;
+  cur->stackmapped = 0;
+  release(vmlock(p));
+  p->mainthread = cur;
+  if(cur->tid != 0){
+    unhashthread(cur);
+    cur->tid = 0;
+    hashthread(cur);
+  }
+  p->nexttid = 1;
+  p->reaper = 0;
+  release(&ptable.lock);
+  return cur;
+}
+
+// Tell the other CPUs running threads of p to flush their TLBs,
+// without waiting for them.
+static void
+tlbipi(struct proc *p)
+{
+  struct cpu *c;
+  struct thread *t;
+
+  pushcli();
+  __sync_synchronize();
+  for(c = cpus; c < cpus+ncpu; c++){
+    t = c->thread;
+    if(c == mycpu() || t == 0 || t->proc != p)
+      continue;
+    c->tlbflush = 1;
+    lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+  }
+  popcli();
+}
+
+// Make the other CPUs running threads of p drop TLB entries
+// for mappings p's page table no longer has, and wait until they
+// have. Must be called with no locks held, since the other CPUs
+// need interrupts on to answer. One of them may be waiting in here
+// for us at the same time, so while we wait we answer ours too.
+// The freed pages may be reused before the last answer comes
+// back; a thread still touching memory its process is giving up
+// gets what it deserves.
+void
+tlbshootdown(struct proc *p)
+{
+  struct cpu *c;
+
+  tlbipi(p);
+  for(c = cpus; c < cpus+ncpu; c++){
+    while(c->tlbflush){
+      pushcli();
+      if(mycpu()->tlbflush){
+        lcr3(rcr3());
+        mycpu()->tlbflush = 0;
+      }
+      popcli();
+    }
+  }
 }
 
 //PAGEBREAK: 32
@@ -74,16 +660,12 @@ static struct proc*
 allocproc(void)
 {
   struct proc *p;
-  struct thread *main_thread;
-  char *sp;
 
   acquire(&ptable.lock);
 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED) {
-      main_thread = &(p->ttable[0]);
+    if(p->state == UNUSED)
       goto found;
-    }
 
   release(&ptable.lock);
   return 0;
@@ -92,37 +674,27 @@ found:
   //process(main thread) info
   p->state = EMBRYO;
   p->pid = nextpid++;
-  p->cur_thread = 0;
   p->sz_limit = 0;
+  p->reaper = 0;
+  p->affinity = ~0;
+  p->runticks = p->waitticks = 0;
+  p->nvcsw = p->nivcsw = 0;
+  p->cruntick = p->cwaittick = 0;
 
   //thread info
-  main_thread->state = EMBRYO;
-  main_thread->tid = 0;
-
-  release(&ptable.lock);
-
-  // Allocate kernel stack.
-  if((main_thread->kstack = kalloc()) == 0){
+  p->threads = 0;
+  p->nsrange = 0;
+  p->nthread = 0;
+  p->nexttid = 0;
+  p->tstacksize = TSTACKPAGES * PGSIZE;
+  if((p->mainthread = allocthread(p)) == 0){
+    dropthreads(p, 0);
     p->state = UNUSED;
-    main_thread->state = UNUSED;
+    release(&ptable.lock);
     return 0;
   }
-  sp = main_thread->kstack + KSTACKSIZE;
-
-  // Leave room for trap frame.
-  sp -= sizeof *main_thread->tf;
-  main_thread->tf = (struct trapframe*)sp;
-
-  // Set up new context to start executing at forkret,
-  // which returns to trapret.
-  sp -= 4;
-  *(uint*)sp = (uint)trapret;
-
-  sp -= sizeof *main_thread->context;
-  main_thread->context = (struct context*)sp;
-  memset(main_thread->context, 0, sizeof *main_thread->context);
-  main_thread->context->eip = (uint)forkret;
 
+  release(&ptable.lock);
   return p;
 }
 
@@ -136,7 +708,7 @@ userinit(void)
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
   p = allocproc();
-  main_thread = &(p->ttable[0]);
+  main_thread = p->mainthread;
   
   initproc = p;
   if((p->pgdir = setupkvm()) == 0)
@@ -163,42 +735,63 @@ userinit(void)
 
   p->state = RUNNABLE;
   main_thread->state = RUNNABLE;
+  main_thread->readytick = ticks;
 
   release(&ptable.lock);
 }
 
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size, or -1 on failure.
+// ptable.lock serializes threads of the process changing sz.
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, oldsz;
   struct proc *curproc = myproc();
 
   acquire(&ptable.lock);
+  acquire(vmlock(curproc));
 
-  sz = curproc->sz;
+  sz = oldsz = curproc->sz;
 
   if(curproc->sz_limit) {
     if(sz+n >curproc->sz_limit) {
+      release(vmlock(curproc));
+      release(&ptable.lock);
       cprintf("EXCEPTION : memory limit - sbrk\n");
       return -1;
     }
   }
 
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the memory: pagefault() maps each page the
+    // first time it is touched.
+    if(sz + n >= KERNBASE || sz + n < sz){
+      release(vmlock(curproc));
+      release(&ptable.lock);
       return -1;
+    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(vmlock(curproc));
+      release(&ptable.lock);
       return -1;
+    }
   }
   curproc->sz = sz;
-  switchuvm(curproc);
-  
+  if(n < 0)
+    clipsranges(curproc);
+  switchuvm(mythread());
+
+  release(vmlock(curproc));
   release(&ptable.lock);
-  return 0;
+
+  // Sibling threads on other CPUs may still map what was freed.
+  if(n < 0)
+    tlbshootdown(curproc);
+  return oldsz;
 }
 
 // Create a new process copying p as the parent.
@@ -217,25 +810,33 @@ fork(void)
     return -1;
   }
 
-  main_thread = &(np->ttable[0]);
+  main_thread = np->mainthread;
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    kfree(main_thread->kstack);
-    np->kstack = 0;
-    main_thread->kstack = 0;
+  // Copy process state from proc. The vmlock keeps sibling threads
+  // from changing the page table copyuvm() is marking copy-on-write,
+  // without holding up every other process while it runs.
+  acquire(vmlock(curproc));
+  np->pgdir = copyuvm(curproc->pgdir, curproc->sz);
+  np->sz = curproc->sz;
+  lcr3(V2P(curproc->pgdir));
+  release(vmlock(curproc));
+
+  acquire(&ptable.lock);
+  if(np->pgdir == 0){
+    dropthreads(np, 0);
     np->state = UNUSED;
-    main_thread->state = UNUSED;
+    release(&ptable.lock);
+    if(curproc->nthread > 1)
+      tlbshootdown(curproc);
     return -1;
   }
 
-  acquire(&ptable.lock);
-
-  np->sz = curproc->sz;
   np->sz_limit = curproc->sz_limit;
+  np->affinity = curproc->affinity;
+  np->tstacksize = curproc->tstacksize;
   np->parent = curproc;
-  *main_thread->tf = *curproc->tf;
+  *main_thread->tf = *mythread()->tf;
+  main_thread->tls = mythread()->tls;
 
   // Clear %eax so that fork returns 0 in the child.
   main_thread->tf->eax = 0;
@@ -252,9 +853,16 @@ fork(void)
 
   np->state = RUNNABLE;
   main_thread->state = RUNNABLE;
+  main_thread->readytick = ticks;
+  kick(main_thread);
 
   release(&ptable.lock);
 
+  // Siblings must stop writing through entries copyuvm() made
+  // read-only, or the child would see their writes.
+  if(curproc->nthread > 1)
+    tlbshootdown(curproc);
+
   return pid;
 }
 
@@ -265,12 +873,23 @@ void
 exit(void)
 {
   struct proc *curproc = myproc();
+  struct thread *curthread = mythread();
   struct proc *p;
   int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
+  // The other threads go first; only the last one closes the
+  // process down.
+  if(killsiblings() < 0){
+    acquire(&ptable.lock);
+    curthread->state = ZOMBIE;
+    wakeup1(curproc->reaper);
+    sched();
+    panic("zombie exit");
+  }
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -299,6 +918,7 @@ exit(void)
   }
 
   // Jump into the scheduler, never to return.
+  curthread->state = ZOMBIE;
   curproc->state = ZOMBIE;
   sched();
   panic("zombie exit");
@@ -324,30 +944,19 @@ wait(void)
 
       if(p->state == ZOMBIE) {
         pid = p->pid;
-        struct thread *t;
-        for(int i=9; i>=0; i--) {
-          t = &(p->ttable[i]);
-          if(t->state == UNUSED) continue;
-
-          kfree(t->kstack);
-          t->tid = 0;
-          t->chan = 0;
-          t->tf = 0;
-          t->context = 0;
-          t->kstack = 0;
-          t->state = UNUSED;    
-        }
+        curproc->cruntick += p->runticks + p->cruntick;
+        curproc->cwaittick += p->waitticks + p->cwaittick;
+        dropthreads(p, 0);
+        p->mainthread = 0;
 
         freevm(p->pgdir);
         p->pid = 0;
-        p->kstack = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
+        p->reaper = 0;
         p->state = UNUSED;
 
-        for(int i=0; i<9; i++) p->thread_pool[i] = 0;
-        
         release(&ptable.lock);
         return pid;
       }
@@ -355,7 +964,7 @@ wait(void)
   
 
     // No point waiting if we don't have any children.
-    if(!havekids || curproc->killed){
+    if(!havekids || mythread()->killed){
       release(&ptable.lock);
       return -1;
     }
@@ -365,96 +974,126 @@ wait(void)
   }
 }
 
+// Thread to hand the CPU to when thread t blocks or exits: a
+// runnable sibling of t if there is one, else a runnable thread of
+// the next process. Must be called with ptable.lock held.
+static struct thread*
+nextthread(struct thread *t)
+{
+  struct proc *p = t->proc;
+  struct proc *q;
+  struct thread *u;
+  int n;
+
+  for(n = 0; n < NPROC; n++){
+    q = &ptable.proc[(p - ptable.proc + n) % NPROC];
+    if(q->state != RUNNABLE || !allowed(q, mycpu()))
+      continue;
+    for(u = q->threads; u; u = u->pnext)
+      if(u->state == RUNNABLE)
+        return u;
+  }
+  return 0;
+}
+
+// Make thread t the one running on CPU c, and charge its process
+// for the time t waited since it became RUNNABLE. The caller then
+// swtch()es to t->context. Must be called with ptable.lock held.
+static void
+runthread(struct cpu *c, struct thread *t)
+{
+  t->proc->waitticks += ticks - t->readytick;
+  c->thread = t;
+  t->cpu = c;
+  switchuvm(t);
+  t->state = RUNNING;
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
-//  - swtch to start running that process
-//  - eventually that process transfers control
+//  - choose a thread to run
+//  - swtch to start running that thread
+//  - eventually that thread transfers control
 //      via swtch back to the scheduler.
+// Threads are scheduled on their own, so those of one process can
+// run on several CPUs at once.
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
   struct thread *t;
-  c->proc = 0;
+  int ran, pass;
+  c->thread = 0;
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
+    // Loop over process table looking for a thread to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE){
-        continue;
-      }
-
-        int i = 0;
-        for(t = &(p->ttable[0]); t < &(p->ttable[10]); t++){ // find last_sched thread arr index
-          if(t->tid == p->cur_thread)
+    ran = 0;
+    // First pass: threads that last ran on this CPU, or never ran,
+    // whose cache is warm here. Second pass, only when the first
+    // found nothing: any thread this CPU may run.
+    for(pass = 0; pass < 2 && !ran; pass++){
+      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+        // p->state only says p is alive; each thread runs or
+        // sleeps on its own.
+        if(p->state != RUNNABLE || !allowed(p, c))
+          continue;
+
+        for(t = p->threads; t; t = t->pnext){
+          if(t->state != RUNNABLE)
+            continue;
+          if(pass == 0 && t->cpu != 0 && t->cpu != c)
+            continue;
+
+          // Switch to chosen thread.  It is the thread's job
+          // to release ptable.lock and then reacquire it
+          // before jumping back to us.
+          runthread(c, t);
+          ran = 1;
+
+          swtch(&(c->scheduler), t->context);
+          switchkvm();
+
+          // Thread is done running for now.
+          // It should have changed its t->state before coming back.
+          // sched() may have handed the CPU on to other threads
+          // first, so it need not be t that came back.
+          c->thread = 0;
+
+          // Its thread list may have changed under us, and with
+          // exec even lost t.
+          if(p->state != RUNNABLE || t->proc != p)
             break;
-          i++;
         }
+      }
+    }
 
-        int idx, thread_num;
-        for(idx = 1; idx <= 10; idx++) { // find which thread have to be scheduling
-          thread_num = i + idx;
-          if(( t = (&(p->ttable[thread_num%10])) )->state == RUNNABLE){
-          
-            copy_thread(p,t);
-            // Switch to chosen process.  It is the process's job
-            // to release ptable.lock and then reacquire it
-            // before jumping back to us.
-            c->proc = p;
-            switchuvm(p);
-            p->state = RUNNING;
-
-            swtch(&(c->scheduler), p->context);
-            switchkvm();
-
-            if(p->state != ZOMBIE)
-              copy_process(p,&(p->ttable[p->cur_thread]));
-            else break;
-
-            // Process is done running for now.
-            // It should have changed its p->state before coming back.
-            c->proc = 0;          
-          }
-        }
+    if(!ran){
+      // Nothing to run: halt until a timer tick or a kick().
+      // Keep interrupts off until the hlt so that a kick sent
+      // after we release ptable.lock is not taken too early.
+      c->idle = 1;
+      pushcli();
+      release(&ptable.lock);
+      stihlt();
+      cli();
+      c->idle = 0;
+      popcli();
+      continue;
     }
     release(&ptable.lock);
 
   }
 }
 
-void 
-copy_thread(struct proc* running_p, struct thread* running_thread)
-{
-  pushcli();
-
-  running_p->kstack = running_thread->kstack;
-  running_p->tf = running_thread->tf;
-  running_p->context = running_thread->context;
-
-  running_p->cur_thread = running_thread->tid;
-  popcli();
-}
-
-void 
-copy_process(struct proc* running_p, struct thread* running_thread)
-{
-  pushcli();
-  running_thread->kstack = running_p->kstack;
-  running_thread->tf = running_p->tf;
-  running_thread->context = running_p->context;
-  popcli();
-}
-
 // Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
+// and have changed the thread's state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->ncli, but that would
@@ -464,18 +1103,27 @@ void
 sched(void)
 {
   int intena;
-  struct proc *p = myproc();
+  struct thread *t = mythread();
+  struct thread *nt;
 
   if(!holding(&ptable.lock))
     panic("sched ptable.lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
-  if(p->state == RUNNING)
+  if(t->state == RUNNING)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = mycpu()->intena;
-  swtch(&p->context, mycpu()->scheduler);
+  if((t->state == SLEEPING || t->state == ZOMBIE) &&
+     (nt = nextthread(t)) != 0){
+    // The thread blocked or exited: hand the CPU straight to the
+    // next thread instead of passing through scheduler(), which
+    // would take a second swtch.
+    runthread(mycpu(), nt);
+    swtch(&t->context, nt->context);
+  } else
+    swtch(&t->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
 
@@ -484,7 +1132,8 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  mythread()->state = RUNNABLE;
+  mythread()->readytick = ticks;
   sched();
   release(&ptable.lock);
 }
@@ -516,11 +1165,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
-  struct thread *t;
-
-  for(t = p->ttable; t < &(p->ttable[10]); t++) {
-    if(t->tid == p->cur_thread) break;
-  }
+  struct thread *t = mythread();
   
   if(p == 0)
     panic("sleep");
@@ -541,7 +1186,8 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   t->chan = chan;
   t->state = SLEEPING;
-  p->state = RUNNABLE;
+  sleepqadd(t);
+  p->nvcsw++;
 
   sched();
 
@@ -558,22 +1204,37 @@ sleep(void *chan, struct spinlock *lk)
 }
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
+// Wake up at most n threads sleeping on chan, only those of p
+// unless p is 0. Return how many were woken.
 // The ptable lock must be held.
-static void
-wakeup1(void *chan)
+static int
+wakeupn(void *chan, struct proc *p, int n)
 {
-  struct proc *p;
-  struct thread *main_thread;
-  struct thread *t;
+  struct thread *t, **tp;
+  int woken = 0;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    main_thread = &(p->ttable[0]);
-    for(t = main_thread; t< &(p->ttable[10]); t++) {
-      if(t->state == SLEEPING && t->chan == chan)
-        t->state = RUNNABLE; 
-      }
+  tp = sleepbucket(chan);
+  while(woken < n && (t = *tp) != 0){
+    if(t->chan != chan || (p && t->proc != p)){
+      tp = &t->slnext;
+      continue;
+    }
+    *tp = t->slnext;
+    t->slnext = 0;
+    t->state = RUNNABLE;
+    t->readytick = ticks;
+    kick(t);
+    woken++;
   }
+  return woken;
+}
+
+// Wake up all processes sleeping on chan.
+// The ptable lock must be held.
+void
+wakeup1(void *chan)
+{
+  wakeupn(chan, 0, MAXTHREAD);
 }
 
 
@@ -599,11 +1260,14 @@ kill(int pid)
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->pid == pid){
       p->killed = 1;
-      thread = &(p->ttable[0]);
-      // Wake process from sleep if necessary.
-      for(thread = &(p->ttable[0]); thread < &(p->ttable[10]); thread++){
+      // Every thread dies on its own way back to user space.
+      // Wake those asleep so they get there.
+      for(thread = p->threads; thread; thread = thread->pnext){
+        if(thread->state == UNUSED)
+          continue;
+        thread->killed = 1;
         if(thread->state == SLEEPING)
-          thread->state = RUNNABLE;
+          wakethread(thread);
       }
       release(&ptable.lock);
       return 0;
@@ -657,6 +1321,27 @@ setmemorylimit(int pid, int limit)
   return 0;
 }
 
+// State of live process p as seen from outside: RUNNING if any of
+// its threads is, else RUNNABLE if any could be, else SLEEPING.
+// The ptable lock must be held.
+static enum procstate
+procstate(struct proc *p)
+{
+  struct thread *t;
+  enum procstate s;
+
+  if(p->state != RUNNABLE)
+    return p->state;
+  s = SLEEPING;
+  for(t = p->threads; t; t = t->pnext){
+    if(t->state == RUNNING)
+      return RUNNING;
+    if(t->state == RUNNABLE)
+      s = RUNNABLE;
+  }
+  return s;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -675,7 +1360,9 @@ procdump(void)
   int i;
   int pnum = 0;
   struct proc *p;
+  struct cpu *c;
   struct thread *t;
+  enum procstate s;
   char *state;
   uint pc[10];
 
@@ -685,31 +1372,28 @@ procdump(void)
       
     pnum++;
     cprintf("\n-------------\n");
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
+    s = procstate(p);
+    if(s >= 0 && s < NELEM(states) && states[s])
+      state = states[s];
     else
       state = "???";
     cprintf("%d. pid : %d\n", pnum, p->pid);
     cprintf("state : %s | name : %s\n", state, p->name);
-    cprintf("current thread : %d\n", p->cur_thread);
     cprintf("stack pages : %d | memory size : %d | memory limit %d\n",(p->sz)/4096, p->sz, p->sz_limit);
-    if(p->state == SLEEPING){
-      getcallerpcs((uint*)p->context->ebp+2, pc);
-      for(i=0; i<10 && pc[i] != 0; i++)
-        cprintf(" %p", pc[i]);
-    }
-    cprintf("\n\n");
+    cprintf("\n");
 
     cprintf("threads\n");
 
-    for(t = p->ttable; t < &(p->ttable[10]); t++) {
+    for(t = p->threads; t; t = t->pnext) {
       if(t->state == UNUSED) continue;
       if(t->state >= 0 && t->state < NELEM(states) && states[t->state])
         state = states[t->state];
       else
         state = "???";
       cprintf("%d %s", t->tid, state);
-      if(p->state == SLEEPING){
+      if(t->cpu && t->state == RUNNING)
+        cprintf(" cpu%d", t->cpu - cpus);
+      if(t->state == SLEEPING){
         getcallerpcs((uint*)t->context->ebp+2, pc);
         for(i=0; i<10 && pc[i] != 0; i++)
         cprintf(" %p", pc[i]);
@@ -718,4 +1402,256 @@ procdump(void)
       cprintf("\n\n");
     }
   }
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    cprintf("cpu%d : idle %d of %d ticks\n", c - cpus, c->idleticks, c->nticks);
+}
+
+// Copy statistics of up to n processes into ps.
+// Return the number of records filled.
+int
+getpstat(struct pstat *ps, int n)
+{
+  struct proc *p;
+  struct thread *t;
+  int i;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++){
+    if(p->state == UNUSED)
+      continue;
+    ps[i].pid = p->pid;
+    ps[i].ppid = p->parent ? p->parent->pid : 0;
+    ps[i].state = procstate(p);
+    safestrcpy(ps[i].name, p->name, sizeof(ps[i].name));
+    ps[i].nthread = p->nthread;
+    ps[i].sz = p->sz;
+    ps[i].sz_limit = p->sz_limit;
+    ps[i].runticks = p->runticks;
+    ps[i].waitticks = p->waitticks;
+    // and what its threads have waited so far
+    if(p->state == RUNNABLE)
+      for(t = p->threads; t; t = t->pnext)
+        if(t->state == RUNNABLE)
+          ps[i].waitticks += ticks - t->readytick;
+    ps[i].nvcsw = p->nvcsw;
+    ps[i].nivcsw = p->nivcsw;
+    ps[i].cruntick = p->cruntick;
+    ps[i].cwaittick = p->cwaittick;
+    i++;
+  }
+  release(&ptable.lock);
+  return i;
+}
+
+// Let process pid run only on the CPUs whose bits are set in mask.
+// It moves off a CPU no longer allowed at its next switch.
+int
+setaffinity(int pid, int mask)
+{
+  struct proc *p;
+  struct thread *t;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      p->affinity = mask;
+      for(t = p->threads; t; t = t->pnext)
+        if(t->state == RUNNABLE)
+          kick(t);
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// CPU mask of process pid, or -1 if there is none.
+int
+getaffinity(int pid)
+{
+  struct proc *p;
+  int mask;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      mask = p->affinity & ((1 << ncpu) - 1);
+      release(&ptable.lock);
+      return mask;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Make user page va of p present, and writable if write is set:
+// map a zeroed page where sbrk() only reserved memory, or copy a
+// page fork() left copy-on-write. Thread stack guard pages, and
+// stack ranges the stack cache gave back (see retirethread()), stay
+// unmapped.
+// Returns as cowcopy(): 1 if va now maps a new page that other
+// CPUs may still cache, 0 if done, -1 if p may not touch va or
+// memory ran out. p's vmlock must be held.
+int
+faultin(struct proc *p, uint va, int write)
+{
+  struct thread *t;
+  uint a;
+
+  if(va >= p->sz)
+    return -1;
+  a = PGROUNDDOWN(va);
+  if(uva2ka(p->pgdir, (char*)a) == 0){
+    if(insrange(p, a))
+      return -1;
+    for(t = p->threads; t; t = t->pnext){
+      if(t->start == 0 || a < t->start)
+        continue;
+      if(a < t->start + PGSIZE ||
+         (!t->stackmapped && a < t->start + PGSIZE + t->stacksize))
+        return -1;
+    }
+    if(mapzero(p->pgdir, a) < 0)
+      return -1;
+  }
+  return write ? cowcopy(p->pgdir, a) : 0;
+}
+
+// Handle a page fault at va with error code err, in user space or
+// in the kernel touching user memory for a system call.
+// Returns 0 if the access can be retried, -1 if it is a real fault
+// or there is no memory.
+int
+pagefault(uint va, uint err)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  int locked, r;
+
+  // Reads of present pages fault only when they are forbidden.
+  if(p == 0 || ((err & FEC_PR) && !(err & FEC_WR)))
+    return -1;
+  lk = vmlock(p);
+  if(!(locked = holding(lk)))
+    acquire(lk);
+  r = faultin(p, va, err & FEC_WR);
+  if(!locked)
+    release(lk);
+  if(r <= 0)
+    return r < 0 ? -1 : 0;
+
+  // A page was copied. The other CPUs running p must drop the old
+  // translation before this thread goes on, or they would write to
+  // the frame the fork child now owns alone. A fault from user
+  // space holds no lock and can wait. The kernel may fault under a
+  // lock (piperead() filling a buffer), where waiting could deadlock
+  // with a CPU spinning on it with interrupts off; it only tells the
+  // others, and trap() waits before the system call returns.
+  if(err & FEC_U)
+    tlbshootdown(p);
+  else {
+    tlbipi(p);
+    mythread()->tlbpending = 1;
+  }
+  return 0;
+}
+
+// Make the user pages of the current process under [va, va+n)
+// present, and writable if write is set, before a system call
+// uses them, so that running out of memory fails the call instead
+// of a fault inside the kernel, and the kernel's stores do not
+// fault under its own locks. Returns 0, or -1 if one of the pages
+// cannot be had.
+int
+prefault(uint va, uint n, int write)
+{
+  struct proc *p = myproc();
+  uint a, end = va + n;
+  int r, moved;
+
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE)
+    if(!uvaready(p->pgdir, (char*)a, write))
+      break;
+  if(a >= end)
+    return 0;
+
+  r = moved = 0;
+  acquire(vmlock(p));
+  for(; a < end && (r = faultin(p, a, write)) >= 0; a += PGSIZE)
+    moved |= r;
+  release(vmlock(p));
+  if(moved)
+    tlbshootdown(p);
+  return r < 0 ? -1 : 0;
+}
+
+// Kernel address of the user word at uva in the current process,
+// or 0 if uva is not an aligned, mapped user address.
+// The ptable lock must be held, so that the page stays mapped.
+static int*
+futexword(uint uva)
+{
+  struct proc *p = myproc();
+  char *ka;
+  int r;
+
+  if(uva % sizeof(int) != 0)
+    return 0;
+  acquire(vmlock(p));
+  r = faultin(p, uva, 0);
+  release(vmlock(p));
+  if(r < 0)
+    return 0;
+  if((ka = uva2ka(p->pgdir, (char*)uva)) == 0)
+    return 0;
+  return (int*)(ka + (uva & (PGSIZE-1)));
+}
+
+// Sleep until a futexwake() on uva, if the word there still holds
+// val. Checking the word and going to sleep are atomic with respect
+// to futexwake(), which takes the same lock, so a wake sent after
+// the user changed the word is never lost.
+// A futex is named by its process and user address, not by the page
+// behind it, which a copy-on-write fault may replace while threads
+// wait. The sleep channel is uva itself, below KERNBASE where no
+// kernel channel lies; futexwake() wakes only threads of its own
+// process, so a forked child's futexes stay apart from its parent's.
+// Return 0 once woken, or -1 at once if the word differs, uva is
+// bad, or the thread was killed.
+int
+futexwait(uint uva, int val)
+{
+  int *w;
+
+  acquire(&ptable.lock);
+  if((w = futexword(uva)) == 0 || *w != val){
+    release(&ptable.lock);
+    return -1;
+  }
+  sleep((void*)uva, &ptable.lock);
+  release(&ptable.lock);
+  return mythread()->killed ? -1 : 0;
+}
+
+// Wake at most n threads waiting in futexwait() on uva.
+// Return how many were woken, or -1 if uva is bad.
+int
+futexwake(uint uva, int n)
+{
+  struct proc *p = myproc();
+  int woken;
+
+  if(uva % sizeof(int) != 0 || uva >= p->sz)
+    return -1;
+  acquire(&ptable.lock);
+  woken = wakeupn((void*)uva, p, n);
+  release(&ptable.lock);
+  return woken;
 }
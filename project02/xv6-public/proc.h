@@ -7,7 +7,11 @@ struct cpu {
   volatile uint started;       // Has the CPU started?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
-  struct proc *proc;           // The process running on this cpu or null
+  struct thread *thread;       // The thread running on this cpu or null
+  volatile int tlbflush;       // Set until an IRQ_TLB sent here is handled
+  volatile int idle;           // Halted in scheduler(), needs an IPI to wake
+  uint nticks;                 // Timer ticks seen by this CPU
+  uint idleticks;              // Ticks of those with no process running
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,15 +38,39 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// Size of the (proc, tid) -> thread hash, see findthread().
+#define NTIDHASH 64
+
 struct thread {
-  uint start;                  // thread pool idx;
+  uint start;                  // Bottom (guard page) of its user stack, or 0
+  uint stacksize;              // Bytes of user stack above the guard page
+  int stackmapped;             // Whether those are mapped, see retirethread()
   thread_t tid;                // thread ID
+  thread_t ptid;               // Thread that created it, for thread_join_any
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // thread state
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct thread *slnext;       // Next thread in chan's sleep queue
   void *retval;                // Return value
+  uint exitseq;                // When it exited, see thread_join_any()
+  struct proc *proc;           // Process it belongs to
+  int killed;                  // If non-zero, exit at the next chance
+  struct cpu *cpu;             // CPU it last ran on, for a warm cache
+  uint readytick;              // ticks when it last became RUNNABLE
+  uint tls;                    // User address of its TLS block, or 0
+  int tlbpending;              // Other CPUs told to flush, see pagefault()
+  struct thread *pnext;        // Next thread of proc, or in the free list
+  struct thread *hnext;        // Next in its tid hash chain
+};
+
+// Part of a process's memory below sz that must stay unmapped: the
+// guard page and stack of a thread whose descriptor went back to the
+// thread table. Reused for the stacks of later threads.
+struct srange {
+  uint start;
+  uint end;
 };
 
 // Per-process state
@@ -52,21 +80,32 @@ struct proc {
   uint sz;                     // Size of process memory (bytes)
   uint sz_limit;               // limit of memory
   pde_t* pgdir;                // Page table
-  enum procstate state;        // Process state
+  enum procstate state;        // EMBRYO, RUNNABLE while alive, ZOMBIE;
+                               // what runs or sleeps is up to the threads
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
   int killed;                  // If non-zero, have been killed
   char name[16];               // Process name (debugging)
   struct file *ofile[NOFILE];  // Open files 
   struct inode *cwd;           // Current directory
-  struct thread ttable[10];    // thread table. process (the main thread is in the ttable[0])
-  uint thread_pool[10];        // thread reallocate address
+  struct thread *threads;      // Its threads, linked through pnext. Those
+                               // UNUSED are kept for their user stacks
+  struct srange srange[NSRANGE]; // Freed stack ranges, see retirethread()
+  int nsrange;
+  struct thread *mainthread;   // The main thread, tid 0
+  int nthread;                 // Threads in use, at most NTHREAD
+  thread_t nexttid;            // Next thread ID to hand out
+  uint nexited;                // Threads that have exited, for exitseq
+  uint tstacksize;             // User stack bytes of threads it creates
+  struct thread *reaper;       // Thread taking the others down, see killsiblings()
+  uint affinity;               // Bit i set: may run on cpus[i]
 
-  // copy from thread
-  char *kstack;                // Bottom of kernel stack for this process
-  struct trapframe *tf;        // Trap frame for current syscall
-  struct context *context;     // swtch() here to run process
-  int cur_thread;              // current thread ID
+  uint runticks;               // Statistics, see pstat.h
+  uint waitticks;
+  uint nvcsw;
+  uint nivcsw;
+  uint cruntick;
+  uint cwaittick;
 };
 
 // Process memory is laid out contiguously, low addresses first:
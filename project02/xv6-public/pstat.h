@@ -0,0 +1,18 @@
+// Per-process scheduling statistics, one record per process,
+// as copied out by the getpstat system call.
+
+struct pstat {
+  int pid;
+  int ppid;              // parent's pid, or 0
+  int state;             // enum procstate
+  char name[16];
+  int nthread;           // threads in use
+  uint sz;               // memory size (bytes)
+  uint sz_limit;         // memory limit, or 0
+  uint runticks;         // ticks spent running
+  uint waitticks;        // ticks its threads were runnable but had no CPU
+  uint nvcsw;            // voluntary switches (sleep, thread_exit)
+  uint nivcsw;           // involuntary switches (timer)
+  uint cruntick;         // runticks of reaped children, summed
+  uint cwaittick;        // waitticks of reaped children, summed
+};
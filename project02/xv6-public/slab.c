@@ -0,0 +1,241 @@
+// Kernel memory allocator for objects smaller than a page.
+// kmalloc(n) returns memory from the smallest size class that
+// holds n bytes. Each class carves whole pages (slabs) from
+// kalloc() into equal objects; a slab's header sits at the start
+// of its page, so kmfree() finds it by rounding the address down.
+// Bigger requests get a block of pages from kallocblk(), with the
+// same header in front.
+//
+// Every CPU keeps a magazine of free objects per class, so that
+// most kmalloc() and kmfree() calls run with interrupts off and
+// take no lock. A magazine refills from, and flushes back to, its
+// class's slabs half a magazine at a time.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "memstat.h"
+
+#define SLABHDR 32   // bytes kept for struct slab at the start of a slab
+#define MAGSIZE 16   // objects per magazine
+
+struct slab {
+  struct slab *next;       // in its class's partial list
+  struct slab *prev;
+  struct kmcache *cache;   // 0 for a kallocblk() block
+  char *freelist;          // free objects, linked through their first word
+  int nfree;
+  int order;               // of a kallocblk() block
+};
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmcache {
+  struct spinlock lock;
+  uint size;               // object size
+  int perslab;             // objects in one slab
+  struct slab partial;     // head of the slabs with free objects
+  uint nslab;
+  uint nout;               // objects not in a slab's free list
+  struct magazine mag[NCPU];
+};
+
+// The classes leave little of a slab unused: 672 holds a pipe, six
+// to a page. Object addresses stay 8-byte aligned.
+static uint kmsizes[NKMCLASS] = { 32, 64, 128, 256, 448, 672, 1016, 2032 };
+
+struct kmcache kmcache[NKMCLASS];
+
+void
+kmallocinit(void)
+{
+  struct kmcache *c;
+  int i;
+
+  for(i = 0; i < NKMCLASS; i++){
+    c = &kmcache[i];
+    initlock(&c->lock, "kmcache");
+    c->size = kmsizes[i];
+    c->perslab = (PGSIZE - SLABHDR) / c->size;
+    c->partial.next = c->partial.prev = &c->partial;
+  }
+}
+
+static void
+slabunlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+slablink(struct kmcache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+// Carve a new page into a slab for c. c->lock must be held.
+static struct slab*
+newslab(struct kmcache *c)
+{
+  struct slab *s;
+  char *o;
+  int i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->order = 0;
+  s->freelist = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    o = (char*)s + SLABHDR + i*c->size;
+    *(char**)o = s->freelist;
+    s->freelist = o;
+  }
+  s->nfree = c->perslab;
+  slablink(c, s);
+  c->nslab++;
+  return s;
+}
+
+// Move objects from c's slabs into magazine m until it is half full.
+static void
+magfill(struct kmcache *c, struct magazine *m)
+{
+  struct slab *s;
+  char *o;
+
+  acquire(&c->lock);
+  while(m->n < MAGSIZE/2){
+    s = c->partial.next;
+    if(s == &c->partial && (s = newslab(c)) == 0)
+      break;
+    o = s->freelist;
+    s->freelist = *(char**)o;
+    if(--s->nfree == 0)
+      slabunlink(s);
+    m->obj[m->n++] = o;
+    c->nout++;
+  }
+  release(&c->lock);
+}
+
+// Return n objects from magazine m to their slabs. A slab left with
+// nothing allocated goes back to kalloc, unless it is c's last one.
+static void
+magflush(struct kmcache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  char *o;
+
+  acquire(&c->lock);
+  while(n-- > 0 && m->n > 0){
+    o = m->obj[--m->n];
+    s = (struct slab*)PGROUNDDOWN((uint)o);
+    *(char**)o = s->freelist;
+    s->freelist = o;
+    if(s->nfree++ == 0)
+      slablink(c, s);
+    c->nout--;
+    if(s->nfree == c->perslab &&
+       !(c->partial.next == s && s->next == &c->partial)){
+      slabunlink(s);
+      c->nslab--;
+      kfree((char*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate n bytes. Returns 0 if there is no memory.
+void*
+kmalloc(uint n)
+{
+  struct kmcache *c;
+  struct magazine *m;
+  struct slab *s;
+  void *v;
+  int order;
+
+  if(n == 0)
+    return 0;
+  for(c = kmcache; c < &kmcache[NKMCLASS]; c++)
+    if(c->size >= n)
+      break;
+
+  if(c == &kmcache[NKMCLASS]){
+    for(order = 0; (PGSIZE << order) < n + SLABHDR; order++)
+      if(order == NKORDER-1)
+        return 0;
+    if((s = (struct slab*)kallocblk(order)) == 0)
+      return 0;
+    s->cache = 0;
+    s->order = order;
+    return (char*)s + SLABHDR;
+  }
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0)
+    magfill(c, m);
+  v = m->n > 0 ? m->obj[--m->n] : 0;
+  popcli();
+  return v;
+}
+
+// Free memory that kmalloc() returned.
+void
+kmfree(void *v)
+{
+  struct slab *s;
+  struct kmcache *c;
+  struct magazine *m;
+
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  if((uint)v < KERNBASE || (char*)v - (char*)s < SLABHDR)
+    panic("kmfree");
+  if((c = s->cache) == 0){
+    kfreeblk((char*)s, s->order);
+    return;
+  }
+  if(c < kmcache || c >= &kmcache[NKMCLASS] ||
+     ((char*)v - (char*)s - SLABHDR) % c->size != 0)
+    panic("kmfree");
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE)
+    magflush(c, m, MAGSIZE/2);
+  m->obj[m->n++] = v;
+  popcli();
+}
+
+// Fill in the kmalloc part of *ms. Magazine counts are read
+// without locks, so they may be slightly off.
+void
+kmallocstat(struct memstat *ms)
+{
+  struct kmcache *c;
+  int i, j, inmag;
+
+  for(i = 0; i < NKMCLASS; i++){
+    c = &kmcache[i];
+    for(j = 0, inmag = 0; j < NCPU; j++)
+      inmag += c->mag[j].n;
+    acquire(&c->lock);
+    ms->kmsize[i] = c->size;
+    ms->kmslabs[i] = c->nslab;
+    ms->kminuse[i] = c->nout - inmag;
+    release(&c->lock);
+  }
+}
@@ -17,6 +17,7 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->tid = 0;
 }
 
 void
@@ -28,6 +29,7 @@ acquiresleep(struct sleeplock *lk)
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->tid = mythread()->tid;
   release(&lk->lk);
 }
 
@@ -37,6 +39,7 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  lk->tid = 0;
   wakeup(lk);
   release(&lk->lk);
 }
@@ -47,7 +50,8 @@ holdingsleep(struct sleeplock *lk)
   int r;
   
   acquire(&lk->lk);
-  r = lk->locked && (lk->pid == myproc()->pid);
+  r = lk->locked && (lk->pid == myproc()->pid) &&
+      (lk->tid == mythread()->tid);
   release(&lk->lk);
   return r;
 }
@@ -6,5 +6,6 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  int tid;           // Thread of that process holding it
 };
 
@@ -14,6 +14,9 @@
 // to a saved program counter, and then the first argument.
 
 // Fetch the int at addr from the current process.
+// Addresses below sz may still be unmapped for good, as a thread
+// stack's guard page is, so the page is checked before the kernel
+// touches it.
 int
 fetchint(uint addr, int *ip)
 {
@@ -21,6 +24,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(prefault(addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +44,9 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    // Check each page the string reaches into, as fetchint() does.
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -49,14 +57,11 @@ fetchstr(uint addr, char **pp)
 int
 argint(int n, int *ip)
 {
-  return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
+  return fetchint((mythread()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
@@ -65,10 +70,30 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(prefault(i, size, write) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
+// Like argptr, for a block the kernel will write into. Pages that
+// fork() left copy-on-write are copied now, so the kernel's stores
+// do not fault.
+int
+argwptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -109,6 +134,16 @@ extern int sys_thread_exit(void);
 extern int sys_thread_join(void);
 extern int sys_setmemorylimit(void);
 extern int sys_procdump(void);
+extern int sys_getpstat(void);
+extern int sys_setaffinity(void);
+extern int sys_getaffinity(void);
+extern int sys_yield(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_thread_create_tls(void);
+extern int sys_thread_stacksize(void);
+extern int sys_thread_join_any(void);
+extern int sys_memstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -138,6 +173,16 @@ static int (*syscalls[])(void) = {
 [SYS_thread_join] sys_thread_join,
 [SYS_setmemorylimit] sys_setmemorylimit,
 [SYS_procdump] sys_procdump,
+[SYS_getpstat] sys_getpstat,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_getaffinity] sys_getaffinity,
+[SYS_yield]   sys_yield,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_thread_create_tls] sys_thread_create_tls,
+[SYS_thread_stacksize] sys_thread_stacksize,
+[SYS_thread_join_any] sys_thread_join_any,
+[SYS_memstat] sys_memstat,
 };
 
 void
@@ -146,12 +191,12 @@ syscall(void)
   int num;
   struct proc *curproc = myproc();
 
-  num = curproc->tf->eax;
+  num = mythread()->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    curproc->tf->eax = syscalls[num]();
+    mythread()->tf->eax = syscalls[num]();
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
-    curproc->tf->eax = -1;
+    mythread()->tf->eax = -1;
   }
 }
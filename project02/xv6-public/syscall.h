@@ -26,3 +26,13 @@
 #define SYS_thread_join 25
 #define SYS_setmemorylimit 26
 #define SYS_procdump 27
+#define SYS_getpstat 28
+#define SYS_setaffinity 29
+#define SYS_getaffinity 30
+#define SYS_yield 31
+#define SYS_futex_wait 32
+#define SYS_futex_wake 33
+#define SYS_thread_create_tls 34
+#define SYS_thread_stacksize 35
+#define SYS_thread_join_any 36
+#define SYS_memstat 37
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "pstat.h"
+#include "memstat.h"
 
 int
 sys_fork(void)
@@ -50,8 +52,9 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  // growproc reads the old size under the lock, since sibling
+  // threads may be growing the process at the same time.
+  if((addr = growproc(n)) < 0)
     return -1;
   return addr;
 }
@@ -67,7 +70,7 @@ sys_sleep(void)
   acquire(&tickslock);
   ticks0 = ticks;
   while(ticks - ticks0 < n){
-    if(myproc()->killed){
+    if(mythread()->killed){
       release(&tickslock);
       return -1;
     }
@@ -99,7 +102,7 @@ sys_thread_create(void)
   void *(*start_routine)(void *);
   void *arg;
 
-  if (argptr(0, &t, sizeof(t)) < 0 ||
+  if (argwptr(0, &t, sizeof(t)) < 0 ||
       argptr(1, (char **)&start_routine, sizeof(void *(*)(void *))) < 0 ||
       argptr(2, (char **)&arg, sizeof(void *)) < 0) {
     return -1;
@@ -109,7 +112,35 @@ sys_thread_create(void)
     return -1;
   }
 
-  return thread_create((thread_t *)t, start_routine, arg);
+  return thread_create((thread_t *)t, start_routine, arg, 0);
+}
+
+int
+sys_thread_create_tls(void)
+{
+  char *t;
+  void *(*start_routine)(void *);
+  void *arg;
+  char *tls;
+
+  if (argwptr(0, &t, sizeof(t)) < 0 ||
+      argptr(1, (char **)&start_routine, sizeof(void *(*)(void *))) < 0 ||
+      argptr(2, (char **)&arg, sizeof(void *)) < 0 ||
+      argptr(3, &tls, sizeof(uint)) < 0 || tls == 0) {
+    return -1;
+  }
+
+  return thread_create((thread_t *)t, start_routine, arg, (uint)tls);
+}
+
+int
+sys_thread_stacksize(void)
+{
+  int npages;
+
+  if (argint(0, &npages) < 0)
+    return -1;
+  return threadstacksize(npages);
 }
 
 int
@@ -130,12 +161,25 @@ sys_thread_join(void)
   void **retval;
 
   if (argint(0, &t) < 0 ||
-      argptr(1, (char **)&retval, sizeof(retval)) < 0)
+      argwptr(1, (char **)&retval, sizeof(retval)) < 0)
     return -1;
 
   return thread_join((thread_t)t, retval);
 }
 
+int
+sys_thread_join_any(void)
+{
+  char *t;
+  void **retval;
+
+  if (argwptr(0, &t, sizeof(thread_t)) < 0 ||
+      argwptr(1, (char **)&retval, sizeof(retval)) < 0)
+    return -1;
+
+  return thread_join_any((thread_t *)t, retval);
+}
+
 int
 sys_setmemorylimit(void)
 {
@@ -154,3 +198,78 @@ sys_procdump(void)
   procdump();
   return 0;
 }
+
+int
+sys_getpstat(void)
+{
+  struct pstat *ps;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;  // all there can be; keeps n*sizeof in range
+  if(argwptr(0, (char**)&ps, n*sizeof(*ps)) < 0)
+    return -1;
+  return getpstat(ps, n);
+}
+
+int
+sys_memstat(void)
+{
+  struct memstat *ms;
+
+  if(argwptr(0, (char**)&ms, sizeof(*ms)) < 0)
+    return -1;
+  kmemstat(ms);
+  kmallocstat(ms);
+  return 0;
+}
+
+int
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+int
+sys_getaffinity(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getaffinity(pid);
+}
+
+int
+sys_yield(void)
+{
+  myproc()->nvcsw++;
+  yield();
+  return 0;
+}
+
+int
+sys_futex_wait(void)
+{
+  int addr, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+int
+sys_futex_wake(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+    return -1;
+  return futexwake(addr, n);
+}
@@ -7,100 +7,54 @@
 #include "proc.h"
 #include "spinlock.h"
 
-extern void forkret(void);
-extern void trapret(void);
 extern struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct thread thread[MAXTHREAD];
+  struct thread *freethread;
+  struct thread *tidhash[NTIDHASH];
+  struct spinlock vmlock[NPROC];
 } ptable;
 
-int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
+// Create a thread running start_routine(arg). If tls is non-zero it
+// is the user address of the thread's TLS block, which %gs will
+// reach; its first word is set to point at the block itself.
+int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg, uint tls)
 {
     struct proc *p = myproc();
 
-    pushcli();
+    // ptable.lock and the vmlock keep p->sz and the thread list
+    // consistent against sibling threads running on other CPUs.
+    acquire(&ptable.lock);
+    acquire(vmlock(p));
     struct thread *t = 0;
-    struct thread *main_thread = &(p->ttable[0]);
-    struct thread *now_thread;
-
-    for(now_thread = main_thread; now_thread < &(p->ttable[10]); now_thread++) {
-        if(now_thread->tid == p->cur_thread) break;
-    }
-    
-    char *sp;
+    struct thread *now_thread = mythread();
 
     // 예외처리
-    // A. 쓰레드 테이블이 가득찼다면 "쓰레드를 더이상 만들 수 없음" 이라고 출력하고 return -1
-    // B. 쓰레드를 골랐는데 main thread가 선택되었을 때 return -1
-    // C. 메인 쓰레드가 아닌 쓰레드가 thread_create를 호출 했을 때 return -1
+    // A. 쓰레드를 더이상 만들 수 없다면 return -1
+    // Any thread may create threads; they are all siblings.
 
-    // 코드 디자인
-    // 1. 할당받을 쓰레드를 탐색
-
-    int chk_valid_thread = 0;
-    int thread_index = 0;
-
-    for(t = main_thread; t < &(p->ttable[10]); t++) {
-        if(t->state == UNUSED) {
-            chk_valid_thread = 1;
-            break;
-        }
-        thread_index++;
-    }
+    // 1. thread를 할당받음 (kernel stack 포함)
 
     // 예외 A
-    if(chk_valid_thread == 0) {
+    if((t = allocthread(p)) == 0) {
         cprintf("EXCEPTION 0 : The maximum number of threads has already been allocated.\n");
-        popcli();
-        return -1;
-    }
-
-    // 예외 B
-    if(thread_index == 0) {
-        cprintf("EXCEPTION 1 : Main thread terminated.\n");
-        popcli();
-        return -1;
-    }
-
-    // 에외 C
-    if(now_thread != main_thread) {
-        cprintf("EXCEPTION 2 : Caller is not main thread\n");
-        popcli();
+        release(vmlock(p));
+        release(&ptable.lock);
         return -1;
     }
 
     //thread info
-    t->state = EMBRYO;
-    t->tid = thread_index;
+    t->killed = p->killed;
+    t->ptid = now_thread->tid;
     *thread = t->tid;
 
-    // 2. thread를 할당받음
-
-    // Allocate kernel stack.
-    if((t->kstack = kalloc()) == 0){
-        p->state = UNUSED;
-        t->state = UNUSED;
-        return 0;
-    }
-
-    sp = t->kstack + KSTACKSIZE;
-
-    // Leave room for trap frame.
-    sp -= sizeof *t->tf;
-    t->tf = (struct trapframe*)sp;
-
-    // Set up new context to start executing at forkret,
-    // which returns to trapret.
-    sp -= 4;
-    *(uint*)sp = (uint)trapret;
-
-    sp -= sizeof *t->context;
-    t->context = (struct context*)sp;
-    memset(t->context, 0, sizeof *t->context);
-    t->context->eip = (uint)forkret;
+    // 2. trap frame은 호출한 thread의 것을 복사
 
     *t->tf = *now_thread->tf;
     t->tf->eax = 0;
+    t->tls = tls;
+    t->tf->gs = tls ? (SEG_UTLS << 3) | DPL_USER : 0;
 
     // 3. thread에 함수 정보 저장
 
@@ -108,43 +62,53 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
     uint spt;
     uint ustack[2];
     pde_t *pgdir = p->pgdir;
-    int i;
-
-    uint pool_sz;
-    int find = 0;
-
-    // thread_pool에 빈 user stack이 있는지 탐색
-    for(i=0; i<10; i++) {
-     if(p->thread_pool[i] != 0) {
-            pool_sz = p->thread_pool[i];
-            p->thread_pool[i] = 0;
-            find = 1;
-            break;
-        }
+    int shoot = 0;
+
+    // 재사용하는 thread의 user stack 영역이 맞지 않으면 버림 (allocthread가
+    // 맞는 것을 찾지 못했거나 sbrk로 p->sz가 줄어든 경우)
+    if(t->start != 0 &&
+       (t->stacksize != p->tstacksize || t->start + PGSIZE + t->stacksize > p->sz)) {
+        shoot |= freestack(t);
+        if(t->start + PGSIZE + t->stacksize <= p->sz)
+            addsrange(p, t->start, t->start + PGSIZE + t->stacksize);
+        t->start = 0;
     }
 
-    // 빈 user stack을 발견하지 못했다면 할당을 해주고 발견했다면 할당하지 않고 재활용함
-    if(find == 0) {
-        // Allocate two pages at the next page boundary.
-        // Make the first inaccessible.  Use the second as the user stack.
-        sz = PGROUNDUP(sz); // round-up stack size to allocate in memory.
+    if(t->start == 0 && (sz = takesrange(p, PGSIZE + p->tstacksize)) != 0) {
+        // 이전 thread가 남긴 stack 영역을 재사용
+        if(allocuvm(pgdir, sz + PGSIZE, sz + PGSIZE + p->tstacksize) == 0) {
+            addsrange(p, sz, sz + PGSIZE + p->tstacksize);
+            goto bad;
+        }
         t->start = sz;
+        t->stacksize = p->tstacksize;
+        t->stackmapped = 1;
+    } else if(t->start == 0) {
+        // Allocate the stack at the next page boundary, above a guard
+        // page left unmapped so that running off the stack faults
+        // instead of scribbling on whatever lies below.
+        sz = PGROUNDUP(p->sz); // round-up stack size to allocate in memory.
         if(p->sz_limit) {
-            if(sz+(2*PGSIZE) > p->sz_limit) {
+            if(sz+PGSIZE+p->tstacksize > p->sz_limit) {
             cprintf("EXCEPTION : memory limit - thread_create\n");
             goto bad;
             }
         }
 
-        if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
+        if(allocuvm(pgdir, sz + PGSIZE, sz + PGSIZE + p->tstacksize) == 0)
             goto bad;
-        clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-        spt = sz;
-    }
-    else {
-        t->start = pool_sz;
-        spt = t->start;
+        t->start = sz;
+        t->stacksize = p->tstacksize;
+        t->stackmapped = 1;
+        // The stack is the process's from now on, even if we fail below.
+        p->sz = sz + PGSIZE + p->tstacksize;
+    } else if(!t->stackmapped) {
+        // 캐시에서 메모리를 돌려준 stack: 같은 주소에 다시 할당
+        if(allocuvm(pgdir, t->start + PGSIZE, t->start + PGSIZE + t->stacksize) == 0)
+            goto bad;
+        t->stackmapped = 1;
     }
+    spt = t->start + PGSIZE + t->stacksize;
 
     // 스택 영역에 인자 저장
 
@@ -152,61 +116,80 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg)
     ustack[1] = (uint)arg;
 
     spt = spt - sizeof(ustack);
-    
-    if(copyout(pgdir, spt, ustack, sizeof(ustack)) < 0) {
-        cprintf("spt : %d\n",spt);
-        panic("dead");
-        goto bad;
+
+    // A cached stack may still be shared with a fork child; break
+    // that first, as for the TLS block below.
+    {
+        int r = faultin(p, spt, 1);
+        if(r < 0 || copyout(pgdir, spt, ustack, sizeof(ustack)) < 0)
+            goto bad;
+        if(r > 0)
+            shoot = 1;
+    }
+
+    // The TLS block may be heap sbrk() has not mapped yet, or a page
+    // still shared with a child; copyout() does not fault pages in.
+    if(tls) {
+        int r = faultin(p, tls, 1);
+        if(r < 0 || copyout(pgdir, tls, &tls, sizeof(tls)) < 0)
+            goto bad;
+        if(r > 0)
+            shoot = 1;
     }
 
-    p->sz = sz;
-    p->pgdir = pgdir;
     t->tf->eip = (uint)start_routine;
     t->tf->esp = spt;
-    switchuvm(p);
+    switchuvm(now_thread);
 
-    t->state = RUNNABLE;
+    // RUNNABLE, and an idle CPU kicked to pick it up.
+    wakethread(t);
 
-    popcli();
+    release(vmlock(p));
+    release(&ptable.lock);
+    if(shoot)
+        tlbshootdown(p);
 
     return 0;
 
   bad:
-    if(pgdir) freevm(pgdir);
-    popcli();
+    // The page table is still the process's own; only undo the thread.
+    freethread(t);
+    release(vmlock(p));
+    release(&ptable.lock);
+    if(shoot)
+        tlbshootdown(p);
     return -1;
 }
 
-void thread_wakeup(void *chan)
-{
-    struct proc *p = myproc();
-    struct thread *main_thread = &(p->ttable[0]);
-    
-    main_thread->state = RUNNABLE;
-}
-
 void thread_exit(void *retval)
 {
     struct proc *p = myproc();
-    struct thread *main_thread = &(p->ttable[0]);
-    struct thread *t;
+    struct thread *main_thread = p->mainthread;
+    struct thread *t = mythread();
+    struct thread *u;
 
     acquire(&ptable.lock);
 
-    for(t = main_thread; t < &(p->ttable[10]); t++) {
-        if(t->tid == p->cur_thread) break;
-    }
-
     if(t == main_thread) {
         cprintf("Exception 0 : Attempting to exit the main thread");
+        release(&ptable.lock);
         return ;
     }
 
-    thread_wakeup(main_thread);
+    // Our children go to the main thread, like orphans to init.
+    for(u = p->threads; u; u = u->pnext)
+        if(u->state != UNUSED && u->ptid == t->tid)
+            u->ptid = main_thread->tid;
+
+    // Joiners sleep on the thread list, whichever thread they are.
+    wakeup1(&p->threads);
+    // A thread taking the process down waits for this one too.
+    if(p->reaper)
+        wakethread(p->reaper);
 
     t->retval = retval;
+    t->exitseq = p->nexited++;
     t->state = ZOMBIE;
-    p->state = RUNNABLE;
 
     sched();
 
@@ -214,51 +197,97 @@ void thread_exit(void *retval)
     panic("zombie exit");
 }
 
+// Free ZOMBIE thread t and release ptable.lock.
+static void reap(struct proc *p, struct thread *t, void **retval)
+{
+    int shoot;
+
+    // The descriptor stays with the process, with its user
+    // stack, for the next thread_create; see retirethread().
+    *retval = t->retval;
+    freethread(t);
+    acquire(vmlock(p));
+    shoot = retirethread(t);
+    release(vmlock(p));
+
+    release(&ptable.lock);
+    if(shoot)
+        tlbshootdown(p);
+}
+
+// Wait for thread to exit and free it. Any thread but the one
+// named may join it; the main thread cannot be joined.
 int thread_join(thread_t thread, void **retval)
 {
     struct proc *p = myproc();
     struct thread *join_thread;
-    struct thread *main_thread = &(p->ttable[p->cur_thread]);
-    int i;
-
-    if(p->cur_thread != 0) {
-        cprintf("EXCEPTION 0 : Not mainthread join\n");
-        return -1;
-    }
+    struct thread *cur = mythread();
 
     acquire(&ptable.lock);
 
-    for(join_thread = p->ttable; join_thread < &(p->ttable[10]); join_thread++) {
-        if(join_thread->tid == thread) break;
-    }
-
     // thread 자원회수
     for(;;) 
     {  
+        // Look it up every time: another joiner may have freed it.
+        if((join_thread = findthread(p, thread)) == 0 ||
+           join_thread == cur || join_thread == p->mainthread) {
+            release(&ptable.lock);
+            return -1;
+        }
+
         if(join_thread->state == ZOMBIE) {
-    
-            kfree(join_thread->kstack);
-            join_thread->kstack = 0;
-            join_thread->state = UNUSED;
-            join_thread->tf = 0;
-            join_thread->context = 0;
-            join_thread->tid = 0;
-
-            *retval = join_thread->retval;
-            join_thread->retval = 0;
-
-            for(i=0; i<10; i++) {
-                if(p->thread_pool[i] == 0) {
-                    p->thread_pool[i] = join_thread->start;
-                }
-            }
-            switchuvm(p);
+            reap(p, join_thread, retval);
+            return 0;
+        }
 
+        if(cur->killed) {
             release(&ptable.lock);
+            return -1;
+        }
+
+        sleep(&p->threads, &ptable.lock);
+    }
+}
+
+// Wait for any thread the caller created to exit, free it and store
+// its id in *thread. Threads are reaped in the order they exit; the
+// main thread also gets those whose creator has exited. Returns -1
+// if the caller has no such thread left.
+int thread_join_any(thread_t *thread, void **retval)
+{
+    struct proc *p = myproc();
+    struct thread *cur = mythread();
+    struct thread *t, *first;
+    int alive;
+
+    acquire(&ptable.lock);
+
+    for(;;)
+    {
+        // The list is in no useful order; pick the earliest to exit.
+        alive = 0;
+        first = 0;
+        for(t = p->threads; t; t = t->pnext) {
+            if(t == cur || t == p->mainthread || t->state == UNUSED ||
+               t->ptid != cur->tid)
+                continue;
+            if(t->state != ZOMBIE)
+                alive = 1;
+            else if(first == 0 || (int)(t->exitseq - first->exitseq) < 0)
+                first = t;
+        }
 
+        if(first) {
+            *thread = first->tid;
+            reap(p, first, retval);
             return 0;
         }
 
-        sleep(main_thread, &ptable.lock);
+        if(!alive || cur->killed) {
+            release(&ptable.lock);
+            return -1;
+        }
+
+        sleep(&p->threads, &ptable.lock);
     }
 }
@@ -1,8 +1,33 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "param.h"
 
+// Default: exec from a thread while its siblings are running.
+// "thread_test bench [nthreads]" splits a fixed CPU-bound job over
+// nthreads threads of one process; with threads scheduled on their
+// own, ticks should drop as nthreads grows up to the CPU count:
+//   make qemu CPUS=4
+//   $ thread_test bench 1
+//   $ thread_test bench 4
+// "thread_test block" checks that sibling threads keep running while
+// one of them is blocked reading an empty pipe.
+// "thread_test sync [nthreads]" stresses the usync.c mutex, barrier,
+// condition variable and reader-writer lock, checking each for lost
+// updates or broken exclusion.
+// "thread_test tls [nthreads]" checks that every thread keeps seeing
+// its own TLS block across context switches.
+// "thread_test stack" churns threads with 2-page stacks and checks
+// that the process does not grow, then checks that a thread running
+// off its stack hits the guard page and takes its process down.
+// "thread_test nested [nthreads]" has nthreads threads each create
+// and reap their own children with thread_join_any, in whatever
+// order they finish, and has the main thread reap them the same way.
+
+#define MAX_WORKER 32  // threads besides the main one
 #define NUM_THREAD 5
+#define BENCH_ROUND 400
+#define ROUND_LOOP 100000
 
 void *thread_main(void *arg)
 {
@@ -26,9 +51,457 @@ void *thread_main(void *arg)
 
 thread_t thread[NUM_THREAD];
 
+void *bench_main(void *arg)
+{
+  volatile int x = 0;
+  int rounds = (int)arg;
+  int i, j;
+
+  for (i = 0; i < rounds; i++)
+    for (j = 0; j < ROUND_LOOP; j++)
+      x += j;
+  thread_exit(0);
+  return 0;
+}
+
+void bench(int nthread)
+{
+  thread_t bthread[MAX_WORKER];
+  void *retval;
+  int i, n, start, elapsed;
+
+  if (nthread <= 0 || nthread > MAX_WORKER) {
+    printf(1, "usage: thread_test bench [1-%d]\n", MAX_WORKER);
+    exit();
+  }
+
+  start = uptime();
+  for (i = 0, n = 0; i < nthread; i++)
+    if (thread_create(&bthread[n], bench_main,
+                      (void *)(BENCH_ROUND / nthread)) == 0)
+      n++;
+  for (i = 0; i < n; i++)
+    thread_join(bthread[i], &retval);
+  elapsed = uptime() - start;
+
+  printf(1, "thread_test bench: %d threads, %d rounds, %d ticks\n",
+         n, n * (BENCH_ROUND / nthread), elapsed);
+  exit();
+}
+
+int fds[2];
+volatile int nspin;
+volatile int stop;
+
+void *reader_main(void *arg)
+{
+  char c;
+
+  if (read(fds[0], &c, 1) != 1)
+    printf(1, "thread_test block: read failed\n");
+  thread_exit(0);
+  return 0;
+}
+
+void *spinner_main(void *arg)
+{
+  while (!stop)
+    nspin++;
+  thread_exit(0);
+  return 0;
+}
+
+void block(void)
+{
+  thread_t reader, spinner[2];
+  void *retval;
+  int i, before, after;
+
+  if (pipe(fds) < 0) {
+    printf(1, "thread_test block: pipe failed\n");
+    exit();
+  }
+  thread_create(&reader, reader_main, 0);
+  for (i = 0; i < 2; i++)
+    thread_create(&spinner[i], spinner_main, 0);
+
+  // The reader is asleep in piperead for the whole window.
+  sleep(10);
+  before = nspin;
+  sleep(50);
+  after = nspin;
+
+  stop = 1;
+  write(fds[1], "x", 1);
+  thread_join(reader, &retval);
+  for (i = 0; i < 2; i++)
+    thread_join(spinner[i], &retval);
+
+  if (after > before)
+    printf(1, "thread_test block: ok, siblings ran %d loops\n",
+           after - before);
+  else
+    printf(1, "thread_test block: FAILED, siblings stalled\n");
+  exit();
+}
+
+#define SYNC_ITER 2000
+#define SYNC_ROUND 200
+#define QSIZE 8
+
+int nsync;
+mutex_t smutex;
+barrier_t sbarrier;
+rwlock_t srwlock;
+cond_t notempty, notfull;
+volatile int scount;
+volatile int slot[MAX_WORKER];
+volatile int queue[QSIZE];
+int qhead, qtail, qlen, nconsumed, qsum;
+volatile int rwa, rwb;
+volatile int nerror;
+
+// Bounded queue through a mutex and two condition variables.
+// Producers put SYNC_ITER items each; consumers take them until all
+// have been taken.
+void produce(void)
+{
+  int i;
+
+  for (i = 1; i <= SYNC_ITER; i++) {
+    mutex_lock(&smutex);
+    while (qlen == QSIZE)
+      cond_wait(&notfull, &smutex);
+    queue[qtail] = i;
+    qtail = (qtail + 1) % QSIZE;
+    qlen++;
+    cond_signal(&notempty);
+    mutex_unlock(&smutex);
+  }
+}
+
+void consume(void)
+{
+  int total = (nsync / 2) * SYNC_ITER;
+
+  mutex_lock(&smutex);
+  for (;;) {
+    while (qlen == 0 && nconsumed < total)
+      cond_wait(&notempty, &smutex);
+    if (nconsumed == total)
+      break;
+    qsum += queue[qhead];
+    qhead = (qhead + 1) % QSIZE;
+    qlen--;
+    nconsumed++;
+    cond_signal(&notfull);
+    if (nconsumed == total)
+      cond_broadcast(&notempty);
+  }
+  mutex_unlock(&smutex);
+}
+
+void *sync_main(void *arg)
+{
+  int id = (int)arg;
+  int i, j;
+
+  // Mutex: no increment may be lost.
+  for (i = 0; i < SYNC_ITER; i++) {
+    mutex_lock(&smutex);
+    scount++;
+    mutex_unlock(&smutex);
+  }
+  barrier_wait(&sbarrier);
+
+  // Barrier: nobody may see a slot from another round.
+  for (i = 0; i < SYNC_ROUND; i++) {
+    slot[id] = i;
+    barrier_wait(&sbarrier);
+    for (j = 0; j < nsync; j++)
+      if (slot[j] != i)
+        nerror++;
+    barrier_wait(&sbarrier);
+  }
+
+  // Condition variables.
+  if (id < nsync / 2)
+    produce();
+  else
+    consume();
+  barrier_wait(&sbarrier);
+
+  // Reader-writer lock: readers must never see a half-done write.
+  for (i = 0; i < SYNC_ITER; i++) {
+    if (i % 8 == id % 8) {
+      rwlock_wrlock(&srwlock);
+      rwa++;
+      for (j = 0; j < 100; j++)
+        ;
+      rwb++;
+      rwlock_wrunlock(&srwlock);
+    } else {
+      rwlock_rdlock(&srwlock);
+      if (rwa != rwb)
+        nerror++;
+      rwlock_rdunlock(&srwlock);
+    }
+  }
+
+  thread_exit(0);
+  return 0;
+}
+
+void sync(int nthread)
+{
+  thread_t sthread[MAX_WORKER];
+  void *retval;
+  int i, start, expect;
+
+  // The queue test needs a producer and a consumer.
+  if (nthread < 2 || nthread > MAX_WORKER) {
+    printf(1, "usage: thread_test sync [2-%d]\n", MAX_WORKER);
+    exit();
+  }
+  nsync = nthread;
+  mutex_init(&smutex);
+  barrier_init(&sbarrier, nthread);
+  rwlock_init(&srwlock);
+  cond_init(&notempty);
+  cond_init(&notfull);
+
+  start = uptime();
+  for (i = 0; i < nthread; i++) {
+    if (thread_create(&sthread[i], sync_main, (void *)i) != 0) {
+      // The others would wait at the barrier forever.
+      printf(1, "thread_test sync: thread_create failed\n");
+      exit();
+    }
+  }
+  for (i = 0; i < nthread; i++)
+    thread_join(sthread[i], &retval);
+
+  expect = (nthread / 2) * (SYNC_ITER * (SYNC_ITER + 1) / 2);
+  if (scount != nthread * SYNC_ITER)
+    printf(1, "thread_test sync: mutex lost %d updates\n",
+           nthread * SYNC_ITER - scount);
+  if (qsum != expect)
+    printf(1, "thread_test sync: queue sum %d, expected %d\n", qsum, expect);
+  if (nerror)
+    printf(1, "thread_test sync: %d barrier/rwlock errors\n", nerror);
+  printf(1, "thread_test sync: %s, %d threads, %d ticks\n",
+         scount == nthread * SYNC_ITER && qsum == expect && nerror == 0 ?
+         "ok" : "FAILED", nthread, uptime() - start);
+  exit();
+}
+
+#define TLS_ITER 20000
+
+// First word points at the block itself, see thread_create_tls.
+struct tlsblock {
+  struct tlsblock *self;
+  int id;
+  int count;
+};
+
+struct tlsblock tlsblocks[MAX_WORKER];
+
+void *tls_main(void *arg)
+{
+  int id = (int)arg;
+  struct tlsblock *b;
+  int i;
+
+  for (i = 0; i < TLS_ITER; i++) {
+    b = tls_get();
+    if (b != &tlsblocks[id] || b->id != id) {
+      nerror++;
+      break;
+    }
+    // Per-thread counter: no lock needed.
+    b->count++;
+    if (i % 1000 == 0)
+      yield();
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void tls(int nthread)
+{
+  thread_t tthread[MAX_WORKER];
+  void *retval;
+  int i, n, ok;
+
+  if (nthread <= 0 || nthread > MAX_WORKER) {
+    printf(1, "usage: thread_test tls [1-%d]\n", MAX_WORKER);
+    exit();
+  }
+  ok = tls_get() == 0;
+  for (i = 0, n = 0; i < nthread; i++) {
+    tlsblocks[i].id = i;
+    if (thread_create_tls(&tthread[i], tls_main, (void *)i, &tlsblocks[i]) == 0)
+      n++;
+  }
+  for (i = 0; i < n; i++)
+    thread_join(tthread[i], &retval);
+  for (i = 0; i < n; i++)
+    if (tlsblocks[i].self != &tlsblocks[i] || tlsblocks[i].count != TLS_ITER)
+      ok = 0;
+
+  printf(1, "thread_test tls: %s, %d threads\n",
+         ok && nerror == 0 && n == nthread ? "ok" : "FAILED", n);
+  exit();
+}
+
+#define CHURN_ROUND 100
+#define CHURN_THREAD 8
+
+void *churn_main(void *arg)
+{
+  volatile char buf[4096];
+
+  // Touch both pages of the stack.
+  buf[0] = buf[sizeof(buf) - 1] = 1;
+  thread_exit(0);
+  return 0;
+}
+
+// Deep enough to run off any thread stack, but bounded, so that
+// the compiler does not flag it.
+#define RECURSE_MAX (MAXTSTACK * 4096 / 512 + 1)
+
+int recurse(int n)
+{
+  volatile char buf[512];
+
+  buf[0] = n;
+  if (n >= RECURSE_MAX)
+    return buf[0];
+  return recurse(n + 1) + buf[0];
+}
+
+void *overflow_main(void *arg)
+{
+  recurse(0);
+  thread_exit(0);
+  return 0;
+}
+
+void stack(void)
+{
+  thread_t cthread[CHURN_THREAD];
+  void *retval;
+  int i, j, pid;
+  uint sz1 = 0, sz2;
+
+  thread_stacksize(2);
+  for (i = 0; i < CHURN_ROUND; i++) {
+    for (j = 0; j < CHURN_THREAD; j++)
+      thread_create(&cthread[j], churn_main, 0);
+    for (j = 0; j < CHURN_THREAD; j++)
+      thread_join(cthread[j], &retval);
+    if (i == 0)
+      sz1 = (uint)sbrk(0);
+  }
+  sz2 = (uint)sbrk(0);
+  printf(1, "thread_test stack: churn %s, size %d after one round, %d after %d\n",
+         sz2 <= sz1 ? "ok" : "FAILED", sz1, sz2, CHURN_ROUND);
+
+  pid = fork();
+  if (pid == 0) {
+    thread_create(&cthread[0], overflow_main, 0);
+    thread_join(cthread[0], &retval);
+    printf(1, "thread_test stack: guard FAILED, overflow went unnoticed\n");
+    exit();
+  }
+  wait();
+  printf(1, "thread_test stack: guard done\n");
+  exit();
+}
+
+#define NEST_CHILD 4
+
+volatile int nestsum;
+
+void *leaf_main(void *arg)
+{
+  // Finish in roughly the reverse order of creation.
+  sleep(NEST_CHILD - (int)arg % NEST_CHILD);
+  __sync_fetch_and_add(&nestsum, 1);
+  thread_exit(arg);
+  return 0;
+}
+
+void *dispatch_main(void *arg)
+{
+  thread_t child[NEST_CHILD], tid;
+  void *retval;
+  int i, j, n, bad = 0;
+
+  for (i = 0, n = 0; i < NEST_CHILD; i++)
+    if (thread_create(&child[i], leaf_main, (void *)((int)arg * NEST_CHILD + i)) == 0)
+      n++;
+  for (i = 0; i < n; i++) {
+    if (thread_join_any(&tid, &retval) != 0) {
+      bad++;
+      break;
+    }
+    // The value must be the one that thread was started with.
+    for (j = 0; j < n && child[j] != tid; j++)
+      ;
+    if (j == n || (int)retval != (int)arg * NEST_CHILD + j)
+      bad++;
+  }
+  // Nothing of ours is left, and the main thread cannot be joined.
+  if (thread_join_any(&tid, &retval) == 0)
+    bad++;
+  thread_exit((void *)(n == NEST_CHILD && bad == 0));
+  return 0;
+}
+
+void nested(int nthread)
+{
+  thread_t tid;
+  void *retval;
+  int i, n, ok;
+
+  if (nthread <= 0 || nthread * (NEST_CHILD + 1) > MAX_WORKER) {
+    printf(1, "usage: thread_test nested [1-%d]\n", MAX_WORKER / (NEST_CHILD + 1));
+    exit();
+  }
+  for (i = 0, n = 0; i < nthread; i++)
+    if (thread_create(&tid, dispatch_main, (void *)i) == 0)
+      n++;
+  ok = n == nthread;
+  for (i = 0; i < n; i++)
+    if (thread_join_any(&tid, &retval) != 0 || retval != (void *)1)
+      ok = 0;
+  if (thread_join_any(&tid, &retval) == 0)
+    ok = 0;
+  printf(1, "thread_test nested: %s, %d of %d leaves ran\n",
+         ok && nestsum == nthread * NEST_CHILD ? "ok" : "FAILED",
+         nestsum, nthread * NEST_CHILD);
+  exit();
+}
+
 int main(int argc, char *argv[])
 {
   int i;
+
+  if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    bench(argc > 2 ? atoi(argv[2]) : 4);
+  if (argc > 1 && strcmp(argv[1], "block") == 0)
+    block();
+  if (argc > 1 && strcmp(argv[1], "sync") == 0)
+    sync(argc > 2 ? atoi(argv[2]) : 4);
+  if (argc > 1 && strcmp(argv[1], "tls") == 0)
+    tls(argc > 2 ? atoi(argv[2]) : 4);
+  if (argc > 1 && strcmp(argv[1], "stack") == 0)
+    stack();
+  if (argc > 1 && strcmp(argv[1], "nested") == 0)
+    nested(argc > 2 ? atoi(argv[2]) : 4);
+
   printf(1, "Thread exec test start\n");
   for (i = 0; i < NUM_THREAD; i++) {
     thread_create(&thread[i], thread_main, (void *)i);
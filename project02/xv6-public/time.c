@@ -0,0 +1,66 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "pstat.h"
+
+// Run a command and show where its time went:
+//   $ time command [args...]
+// real is the elapsed ticks, run the ticks the command and the
+// children it waited for spent on a CPU, and wait the ticks they
+// sat runnable without one. A large wait means starvation.
+
+struct pstat ps[NPROC];
+
+// Copy this process's record into *me.
+int
+self(struct pstat *me)
+{
+  int i, n, pid;
+
+  pid = getpid();
+  n = getpstat(ps, NPROC);
+  for (i = 0; i < n; i++) {
+    if (ps[i].pid == pid) {
+      memmove(me, &ps[i], sizeof(*me));
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct pstat before, after;
+  int pid, start, real;
+
+  if (argc < 2) {
+    printf(2, "usage: time command [args...]\n");
+    exit();
+  }
+
+  if (self(&before) < 0) {
+    printf(2, "time: getpstat failed\n");
+    exit();
+  }
+  start = uptime();
+  pid = fork();
+  if (pid < 0) {
+    printf(2, "time: fork failed\n");
+    exit();
+  }
+  if (pid == 0) {
+    exec(argv[1], argv + 1);
+    printf(2, "time: exec %s failed\n", argv[1]);
+    exit();
+  }
+  wait();
+  real = uptime() - start;
+  self(&after);
+
+  printf(2, "real %d  run %d  wait %d ticks\n", real,
+         after.cruntick - before.cruntick,
+         after.cwaittick - before.cwaittick);
+  exit();
+}
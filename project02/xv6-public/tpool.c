@@ -0,0 +1,303 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// Thread pool with work stealing. tpool_create starts the workers
+// once; parallel_for and parallel_reduce then hand them ranges of a
+// loop as tasks instead of creating a thread per piece of work.
+//
+// Every worker owns a Chase-Lev deque. The owner pushes and pops at
+// the bottom without locking; idle workers steal from the top of a
+// random victim with one compare-and-swap. A task covers a range
+// [lo, hi); whoever runs it keeps splitting off the upper half onto
+// its own deque until the range is down to the grain, so thieves
+// always take the biggest pieces left.
+//
+// Slot 0 belongs to the thread that calls parallel_for, which runs
+// tasks too until the whole job is done. Only one thread may submit
+// work to a pool at a time.
+
+#define TP_MAXWORKER (NTHREAD-1)  // all a process may run but the caller
+#define TP_DEQUE 256       // tasks per deque, a power of two
+#define TP_SPIN 64         // failed steal rounds before sleeping
+
+struct tp_job {
+  void (*fn)(int, int, void*);
+  int (*rfn)(int, int, void*);
+  int (*combine)(int, int);
+  void *arg;
+  int grain;
+  volatile int result;
+  volatile int pending;    // iterations not yet run
+};
+
+struct tp_task {
+  int lo, hi;
+  struct tp_job *job;
+};
+
+struct tp_deque {
+  volatile int top;        // next to steal
+  volatile int bottom;     // next free slot
+  struct tp_task buf[TP_DEQUE];
+};
+
+struct tp_worker {
+  struct tpool *pool;
+  int id;
+  uint seed;
+};
+
+struct tpool {
+  int nworker;
+  volatile int stop;
+  volatile int epoch;      // bumped on every submission, futex word
+  thread_t thread[TP_MAXWORKER];
+  struct tp_worker worker[TP_MAXWORKER+1];
+  struct tp_deque dq[TP_MAXWORKER+1];
+};
+
+// Keep the compiler from moving loads and stores across this point.
+// x86 does not reorder stores with stores or loads with loads, so
+// only pop needs a real fence.
+#define barrier() asm volatile("" ::: "memory")
+
+// Owner only. Return 0 if the deque is full.
+static int
+push(struct tp_deque *d, int lo, int hi, struct tp_job *j)
+{
+  int b;
+  struct tp_task *t;
+
+  b = d->bottom;
+  if(b - d->top >= TP_DEQUE)
+    return 0;
+  t = &d->buf[b & (TP_DEQUE-1)];
+  t->lo = lo;
+  t->hi = hi;
+  t->job = j;
+  barrier();
+  d->bottom = b + 1;
+  return 1;
+}
+
+// Owner only. Take the newest task.
+static int
+pop(struct tp_deque *d, struct tp_task *t)
+{
+  int b, top, ok;
+
+  b = d->bottom - 1;
+  d->bottom = b;
+  // The store to bottom must be visible before top is read, or a
+  // thief and the owner could both take the last task.
+  __sync_synchronize();
+  top = d->top;
+  if(top > b){
+    d->bottom = top;
+    return 0;
+  }
+  *t = d->buf[b & (TP_DEQUE-1)];
+  if(top < b)
+    return 1;
+  // Last task: race the thieves for it.
+  ok = __sync_bool_compare_and_swap(&d->top, top, top + 1);
+  d->bottom = top + 1;
+  return ok;
+}
+
+// Any thread. Take the oldest task.
+static int
+steal(struct tp_deque *d, struct tp_task *t)
+{
+  int top, b;
+
+  top = d->top;
+  barrier();
+  b = d->bottom;
+  if(top >= b)
+    return 0;
+  *t = d->buf[top & (TP_DEQUE-1)];
+  return __sync_bool_compare_and_swap(&d->top, top, top + 1);
+}
+
+static void
+runtask(struct tpool *tp, struct tp_worker *w, struct tp_task *t)
+{
+  struct tp_job *j = t->job;
+  int lo = t->lo, hi = t->hi, mid, v, old;
+
+  while(hi - lo > j->grain){
+    mid = lo + (hi - lo) / 2;
+    if(!push(&tp->dq[w->id], mid, hi, j))
+      break;
+    hi = mid;
+  }
+  if(j->rfn){
+    v = j->rfn(lo, hi, j->arg);
+    do {
+      old = j->result;
+    } while(!__sync_bool_compare_and_swap(&j->result, old,
+                                          j->combine(old, v)));
+  } else
+    j->fn(lo, hi, j->arg);
+  __sync_fetch_and_sub(&j->pending, hi - lo);
+}
+
+// Find a task: our own deque first, then one pass over the others
+// starting at a random victim.
+static int
+findtask(struct tpool *tp, struct tp_worker *w, struct tp_task *t)
+{
+  int i, n, v;
+
+  if(pop(&tp->dq[w->id], t))
+    return 1;
+  n = tp->nworker + 1;
+  w->seed = w->seed * 1103515245 + 12345;
+  v = (w->seed >> 16) % n;
+  for(i = 0; i < n; i++, v = (v + 1) % n)
+    if(v != w->id && steal(&tp->dq[v], t))
+      return 1;
+  return 0;
+}
+
+static void*
+worker_main(void *arg)
+{
+  struct tp_worker *w = arg;
+  struct tpool *tp = w->pool;
+  struct tp_task t;
+  int idle = 0, epoch;
+
+  for(;;){
+    // Read the epoch before looking for work: a job submitted
+    // after this changes it, so futex_wait below returns at once.
+    epoch = tp->epoch;
+    if(findtask(tp, w, &t)){
+      runtask(tp, w, &t);
+      idle = 0;
+      continue;
+    }
+    if(tp->stop)
+      break;
+    if(++idle < TP_SPIN)
+      yield();
+    else {
+      futex_wait((int*)&tp->epoch, epoch);
+      idle = 0;
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Start nworker threads. Return 0 on failure.
+tpool_t*
+tpool_create(int nworker)
+{
+  struct tpool *tp;
+  int i;
+
+  if(nworker < 0 || nworker > TP_MAXWORKER)
+    return 0;
+  if((tp = malloc(sizeof(*tp))) == 0)
+    return 0;
+  memset(tp, 0, sizeof(*tp));
+  for(i = 0; i <= nworker; i++){
+    tp->worker[i].pool = tp;
+    tp->worker[i].id = i;
+    tp->worker[i].seed = i + 1;
+  }
+  for(i = 0; i < nworker; i++){
+    if(thread_create(&tp->thread[i], worker_main, &tp->worker[i+1]) != 0)
+      break;
+    tp->nworker++;
+  }
+  if(tp->nworker < nworker){
+    tpool_destroy(tp);
+    return 0;
+  }
+  return tp;
+}
+
+void
+tpool_destroy(tpool_t *tp)
+{
+  void *retval;
+  int i;
+
+  tp->stop = 1;
+  __sync_fetch_and_add(&tp->epoch, 1);
+  futex_wake((int*)&tp->epoch, tp->nworker);
+  for(i = 0; i < tp->nworker; i++)
+    thread_join(tp->thread[i], &retval);
+  free(tp);
+}
+
+int
+tpool_size(tpool_t *tp)
+{
+  return tp->nworker + 1;
+}
+
+// Queue [0, n) as one task, wake the workers and help until every
+// iteration has run.
+static void
+submit(struct tpool *tp, struct tp_job *j, int n)
+{
+  struct tp_worker *w = &tp->worker[0];
+  struct tp_task t;
+
+  if(n <= 0)
+    return;
+  if(j->grain < 1)
+    j->grain = 1;
+  j->pending = n;
+  push(&tp->dq[0], 0, n, j);
+  if(tp->nworker > 0 && n > j->grain){
+    __sync_fetch_and_add(&tp->epoch, 1);
+    futex_wake((int*)&tp->epoch, tp->nworker);
+  }
+  while(j->pending > 0){
+    if(findtask(tp, w, &t))
+      runtask(tp, w, &t);
+    else
+      yield();
+  }
+}
+
+// Call fn(lo, hi, arg) over disjoint ranges covering [0, n),
+// none longer than grain.
+void
+parallel_for(tpool_t *tp, int n, int grain,
+             void (*fn)(int, int, void*), void *arg)
+{
+  struct tp_job j;
+
+  memset(&j, 0, sizeof(j));
+  j.fn = fn;
+  j.arg = arg;
+  j.grain = grain;
+  submit(tp, &j, n);
+}
+
+// Like parallel_for, but fold the value each range returns into
+// identity with combine, which must be associative and commutative.
+int
+parallel_reduce(tpool_t *tp, int n, int grain,
+                int (*fn)(int, int, void*), int (*combine)(int, int),
+                int identity, void *arg)
+{
+  struct tp_job j;
+
+  memset(&j, 0, sizeof(j));
+  j.rfn = fn;
+  j.combine = combine;
+  j.arg = arg;
+  j.grain = grain;
+  j.result = identity;
+  submit(tp, &j, n);
+  return j.result;
+}
@@ -0,0 +1,141 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Runs the same loop of small tasks three ways: serially, with one
+// thread_create/thread_join per task, and on a thread pool through
+// parallel_reduce and parallel_for. The pool pays for its threads
+// once, so it should win as soon as tasks get small:
+//   make qemu CPUS=4
+//   $ tpool_bench [nworkers] [ntasks]
+
+#define MAX_WORKER 31  // threads besides the main one
+#define NUM_TASK 4096
+#define TASK_LOOP 2000
+#define MAX_ITEM 65536
+
+int data[MAX_ITEM];
+int ntask;
+
+int
+work(int lo, int hi, void *arg)
+{
+  int i, j, s = 0;
+
+  for (i = lo; i < hi; i++)
+    for (j = 0; j < TASK_LOOP; j++)
+      s += (i ^ j) & 7;
+  return s;
+}
+
+int
+add(int a, int b)
+{
+  return a + b;
+}
+
+void
+fill(int lo, int hi, void *arg)
+{
+  int i;
+
+  for (i = lo; i < hi; i++)
+    data[i] = i * (int)arg;
+}
+
+int
+check(int lo, int hi, void *arg)
+{
+  int i, bad = 0;
+
+  for (i = lo; i < hi; i++)
+    if (data[i] != i * (int)arg)
+      bad++;
+  return bad;
+}
+
+volatile int spawn_sum;
+
+void *spawn_main(void *arg)
+{
+  int i = (int)arg;
+
+  __sync_fetch_and_add(&spawn_sum, work(i, i + 1, 0));
+  thread_exit(0);
+  return 0;
+}
+
+// One thread per task, at most nworker + 1 alive at a time.
+int spawn(int nworker)
+{
+  thread_t thread[MAX_WORKER + 1];
+  void *retval;
+  int i, j, n;
+
+  spawn_sum = 0;
+  for (i = 0; i < ntask; i += n) {
+    n = ntask - i < nworker + 1 ? ntask - i : nworker + 1;
+    for (j = 0; j < n; j++) {
+      if (thread_create(&thread[j], spawn_main, (void *)(i + j)) != 0) {
+        printf(1, "tpool_bench: thread_create failed\n");
+        exit();
+      }
+    }
+    for (j = 0; j < n; j++)
+      thread_join(thread[j], &retval);
+  }
+  return spawn_sum;
+}
+
+int main(int argc, char *argv[])
+{
+  tpool_t *tp;
+  int nworker = 3;
+  int t0, serial, s, bad, grain;
+
+  ntask = NUM_TASK;
+  if (argc > 1)
+    nworker = atoi(argv[1]);
+  if (argc > 2)
+    ntask = atoi(argv[2]);
+  if (nworker < 0 || nworker > MAX_WORKER || ntask <= 0 || ntask > MAX_ITEM) {
+    printf(1, "usage: tpool_bench [0-%d] [1-%d]\n", MAX_WORKER, MAX_ITEM);
+    exit();
+  }
+  printf(1, "tpool_bench: %d tasks, %d workers + main\n", ntask, nworker);
+
+  t0 = uptime();
+  serial = work(0, ntask, 0);
+  printf(1, "serial:        %d ticks\n", uptime() - t0);
+
+  t0 = uptime();
+  s = spawn(nworker);
+  printf(1, "thread/task:   %d ticks%s\n", uptime() - t0,
+         s == serial ? "" : " WRONG RESULT");
+
+  t0 = uptime();
+  if ((tp = tpool_create(nworker)) == 0) {
+    printf(1, "tpool_bench: tpool_create failed\n");
+    exit();
+  }
+  printf(1, "pool start:    %d ticks\n", uptime() - t0);
+
+  // Grain 1 gives the pool exactly the tasks the spawn run had.
+  t0 = uptime();
+  s = parallel_reduce(tp, ntask, 1, work, add, 0, 0);
+  printf(1, "pool grain 1:  %d ticks%s\n", uptime() - t0,
+         s == serial ? "" : " WRONG RESULT");
+
+  grain = ntask / (8 * tpool_size(tp));
+  t0 = uptime();
+  s = parallel_reduce(tp, ntask, grain, work, add, 0, 0);
+  printf(1, "pool grain %d: %d ticks%s\n", grain, uptime() - t0,
+         s == serial ? "" : " WRONG RESULT");
+
+  parallel_for(tp, MAX_ITEM, 256, fill, (void *)3);
+  bad = parallel_reduce(tp, MAX_ITEM, 256, check, add, 0, (void *)3);
+  printf(1, "parallel_for:  %s\n", bad == 0 ? "ok" : "WRONG RESULT");
+
+  tpool_destroy(tp);
+  exit();
+}
@@ -37,17 +37,26 @@ void
 trap(struct trapframe *tf)
 {
   if(tf->trapno == T_SYSCALL){
-    if(myproc()->killed)
+    if(mythread()->killed)
       exit();
-    myproc()->tf = tf;
+    mythread()->tf = tf;
     syscall();
-    if(myproc()->killed)
+    // A fault in the call copied a page; see pagefault().
+    if(mythread()->tlbpending){
+      mythread()->tlbpending = 0;
+      tlbshootdown(myproc());
+    }
+    if(mythread()->killed)
       exit();
     return;
   }
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    // Sample what this CPU was doing for the idle statistics.
+    mycpu()->nticks++;
+    if(mycpu()->thread == 0)
+      mycpu()->idleticks++;
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
@@ -56,6 +65,16 @@ trap(struct trapframe *tf)
     }
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKE:
+    // Only there to end a hlt in scheduler().
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_TLB:
+    // Another CPU changed the address space we are running in.
+    lcr3(rcr3());
+    mycpu()->tlbflush = 0;
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -78,6 +97,13 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A first touch of memory sbrk() reserved, or a write to a page
+    // fork() shares copy-on-write, from user space or from a system
+    // call using user memory.
+    if(pagefault(rcr2(), tf->err) == 0)
+      break;
+    // fall through
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -91,22 +117,25 @@ trap(struct trapframe *tf)
             "eip 0x%x addr 0x%x--kill proc\n",
             myproc()->pid, myproc()->name, tf->trapno,
             tf->err, cpuid(), tf->eip, rcr2());
-    myproc()->killed = 1;
+    mythread()->killed = 1;
   }
 
-  // Force process exit if it has been killed and is in user space.
+  // Force thread exit if it has been killed and is in user space.
   // (If it is still executing in the kernel, let it keep running
   // until it gets to the regular system call return.)
-  if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
+  if(mythread() && mythread()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
-      yield();
+  if(mythread() && mythread()->state == RUNNING &&
+     tf->trapno == T_IRQ0+IRQ_TIMER){
+    myproc()->runticks++;
+    myproc()->nivcsw++;
+    yield();
+  }
 
   // Check if the process has been killed since we yielded
-  if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
+  if(mythread() && mythread()->killed && (tf->cs&3) == DPL_USER)
     exit();
 }
@@ -104,3 +104,18 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// The TLS block of the calling thread, as given to
+// thread_create_tls, or 0 if it has none.
+void*
+tls_get(void)
+{
+  ushort gs;
+  void *tls;
+
+  asm volatile("movw %%gs,%0" : "=r" (gs));
+  if(gs == 0)
+    return 0;
+  asm volatile("movl %%gs:0,%0" : "=r" (tls));
+  return tls;
+}
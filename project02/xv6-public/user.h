@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct pstat;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -29,6 +31,16 @@ void thread_exit(void *);
 int thread_join(thread_t, void**);
 int setmemorylimit(int,int);
 int procdump(void);
+int getpstat(struct pstat*, int);
+int setaffinity(int, int);
+int getaffinity(int);
+void yield(void);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int thread_create_tls(thread_t*, void *(*)(void*), void*, void*);
+int thread_stacksize(int);
+int thread_join_any(thread_t*, void**);
+int memstat(struct memstat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -43,3 +55,52 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+void* tls_get(void);
+
+// usync.c
+typedef struct {
+  volatile int state;
+} mutex_t;
+
+typedef struct {
+  volatile int seq;
+  int nwaiter;
+} cond_t;
+
+typedef struct {
+  mutex_t lock;
+  cond_t cv;
+  int n, count, phase;
+} barrier_t;
+
+typedef struct {
+  mutex_t lock;
+  cond_t readers, writers;
+  int nreader, writer, nwriterwait;
+} rwlock_t;
+
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+int mutex_trylock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
+void barrier_init(barrier_t*, int);
+int barrier_wait(barrier_t*);
+void rwlock_init(rwlock_t*);
+void rwlock_rdlock(rwlock_t*);
+void rwlock_rdunlock(rwlock_t*);
+void rwlock_wrlock(rwlock_t*);
+void rwlock_wrunlock(rwlock_t*);
+
+// tpool.c
+typedef struct tpool tpool_t;
+
+tpool_t* tpool_create(int);
+void tpool_destroy(tpool_t*);
+int tpool_size(tpool_t*);
+void parallel_for(tpool_t*, int, int, void (*)(int, int, void*), void*);
+int parallel_reduce(tpool_t*, int, int, int (*)(int, int, void*),
+                    int (*)(int, int), int, void*);
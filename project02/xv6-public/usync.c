@@ -0,0 +1,185 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Thread synchronization for user programs. Every lock word is
+// changed with an atomic instruction; a thread enters the kernel
+// (futex_wait/futex_wake) only when it has to wait or wake someone.
+
+// Mutex states: 0 free, 1 held, 2 held with possible waiters.
+// Taking a free mutex, or releasing one nobody waits for,
+// makes no system call.
+
+void
+mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // Mark the mutex contended so its holder wakes us when done.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait((int*)&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+// Return 0 if the mutex was taken, -1 if it is held.
+int
+mutex_trylock(mutex_t *m)
+{
+  return __sync_val_compare_and_swap(&m->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    m->state = 0;
+    futex_wake((int*)&m->state, 1);
+  }
+}
+
+// Condition variables. seq changes on every signal, so a waiter
+// that read it before dropping the mutex does not sleep through a
+// signal sent in between. Signal and broadcast with the mutex held;
+// with no waiters they make no system call.
+
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+  c->nwaiter = 0;
+}
+
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  int seq;
+
+  seq = c->seq;
+  c->nwaiter++;
+  mutex_unlock(m);
+  futex_wait((int*)&c->seq, seq);
+  mutex_lock(m);
+  c->nwaiter--;
+}
+
+void
+cond_signal(cond_t *c)
+{
+  if(c->nwaiter == 0)
+    return;
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake((int*)&c->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  if(c->nwaiter == 0)
+    return;
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake((int*)&c->seq, c->nwaiter);
+}
+
+// Barriers. The phase counts completed rounds, so a thread that
+// races ahead into the next round cannot release the waiters of
+// this one early.
+
+void
+barrier_init(barrier_t *b, int n)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->cv);
+  b->n = n;
+  b->count = 0;
+  b->phase = 0;
+}
+
+// Wait until n threads have called barrier_wait.
+// Return 1 in the last thread to arrive, 0 in the others.
+int
+barrier_wait(barrier_t *b)
+{
+  int phase;
+
+  mutex_lock(&b->lock);
+  if(++b->count == b->n){
+    b->count = 0;
+    b->phase++;
+    cond_broadcast(&b->cv);
+    mutex_unlock(&b->lock);
+    return 1;
+  }
+  phase = b->phase;
+  while(phase == b->phase)
+    cond_wait(&b->cv, &b->lock);
+  mutex_unlock(&b->lock);
+  return 0;
+}
+
+// Reader-writer locks. Readers share the lock; a waiting writer
+// keeps new readers out so that it is not starved.
+
+void
+rwlock_init(rwlock_t *rw)
+{
+  mutex_init(&rw->lock);
+  cond_init(&rw->readers);
+  cond_init(&rw->writers);
+  rw->nreader = 0;
+  rw->writer = 0;
+  rw->nwriterwait = 0;
+}
+
+void
+rwlock_rdlock(rwlock_t *rw)
+{
+  mutex_lock(&rw->lock);
+  while(rw->writer || rw->nwriterwait > 0)
+    cond_wait(&rw->readers, &rw->lock);
+  rw->nreader++;
+  mutex_unlock(&rw->lock);
+}
+
+void
+rwlock_rdunlock(rwlock_t *rw)
+{
+  mutex_lock(&rw->lock);
+  if(--rw->nreader == 0)
+    cond_signal(&rw->writers);
+  mutex_unlock(&rw->lock);
+}
+
+void
+rwlock_wrlock(rwlock_t *rw)
+{
+  mutex_lock(&rw->lock);
+  rw->nwriterwait++;
+  while(rw->writer || rw->nreader > 0)
+    cond_wait(&rw->writers, &rw->lock);
+  rw->nwriterwait--;
+  rw->writer = 1;
+  mutex_unlock(&rw->lock);
+}
+
+void
+rwlock_wrunlock(rwlock_t *rw)
+{
+  mutex_lock(&rw->lock);
+  rw->writer = 0;
+  if(rw->nwriterwait > 0)
+    cond_signal(&rw->writers);
+  else
+    cond_broadcast(&rw->readers);
+  mutex_unlock(&rw->lock);
+}
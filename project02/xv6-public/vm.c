@@ -152,15 +152,15 @@ switchkvm(void)
   lcr3(V2P(kpgdir));   // switch to the kernel page table
 }
 
-// Switch TSS and h/w page table to correspond to process p.
+// Switch TSS and h/w page table to correspond to thread t.
 void
-switchuvm(struct proc *p)
+switchuvm(struct thread *t)
 {
-  if(p == 0)
-    panic("switchuvm: no process");
-  if(p->kstack == 0)
+  if(t == 0)
+    panic("switchuvm: no thread");
+  if(t->kstack == 0)
     panic("switchuvm: no kstack");
-  if(p->pgdir == 0)
+  if(t->proc->pgdir == 0)
     panic("switchuvm: no pgdir");
 
   pushcli();
@@ -168,12 +168,15 @@ switchuvm(struct proc *p)
                                 sizeof(mycpu()->ts)-1, 0);
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  mycpu()->ts.esp0 = (uint)t->kstack + KSTACKSIZE;
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  // %gs of a thread with TLS selects SEG_UTLS; trapret reloads it,
+  // and with it this base, on the way back to user space.
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, t->tls, 0xffffffff, DPL_USER);
+  lcr3(V2P(t->proc->pgdir));  // switch to process's address space
   popcli();
 
 }
@@ -312,31 +315,33 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The two share every page, read-only and
+// marked PTE_COW, until one of them writes to it; see cowcopy().
+// Turns the parent's writable entries read-only, so the caller
+// must flush the parent's TLB entries on every CPU.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // Thread stack guard pages, and stacks given back from the
+    // stack cache, leave holes below sz.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
+    if(flags & PTE_W){
+      flags = (flags & ~PTE_W) | PTE_COW;
+      *pte = pa | flags;
     }
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      goto bad;
+    kref(P2V(pa));
   }
   return d;
 
@@ -353,25 +358,108 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
+// Return 1 if user address uva is mapped in pgdir, and writable
+// if write is set, so that the kernel can use it without faulting.
+int
+uvaready(pde_t *pgdir, char *uva, int write)
+{
+  pte_t *pte;
+  uint need = PTE_P | PTE_U | (write ? PTE_W : 0);
+
+  pte = walkpgdir(pgdir, uva, 0);
+  return pte != 0 && (*pte & need) == need;
+}
+
+// Map a zeroed page at user address va in pgdir, where sbrk()
+// only reserved memory. Returns 0, or -1 if there is no memory.
+// A page already mapped there is left alone. The caller keeps
+// pgdir from changing underneath.
+int
+mapzero(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P))
+    return 0;
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Make the page at user address va in pgdir writable again after
+// copyuvm() shared it: copy it, or take it over if no other page
+// table maps it any more. Returns 1 if va now maps a new page, in
+// which case other CPUs may still cache the old translation; 0 if
+// the page was made writable in place or already was; -1 if va is
+// not a copy-on-write page or there is no memory for the copy.
+// The caller keeps pgdir from changing underneath.
+int
+cowcopy(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+  int moved = 0;
+
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+    return -1;
+  if(*pte & PTE_W)
+    goto flush;  // another thread got here first
+  if(!(*pte & PTE_COW))
+    return -1;
+
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcount(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+    moved = 1;
+  } else
+    *pte = pa | flags;
+
+flush:
+  if(rcr3() == V2P(pgdir))
+    lcr3(V2P(pgdir));
+  return moved;
+}
+
 // Copy len bytes from p to user address va in page table pgdir.
+// The kernel's own mapping ignores PTE_COW, so pages still shared
+// are copied first; if other threads may be running on pgdir, the
+// caller must break copy-on-write itself and flush their TLBs.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
+  pte_t *pte;
   char *buf, *pa0;
   uint n, va0;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if((pte = walkpgdir(pgdir, (char*)va0, 0)) != 0 && (*pte & PTE_COW) &&
+       cowcopy(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -117,6 +117,16 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one arrives.
+// sti takes effect only after the following instruction, so an
+// interrupt that is already pending wakes the hlt instead of
+// being taken just before it.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt" : : : "memory");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -138,6 +148,14 @@ rcr2(void)
   return val;
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
 static inline void
 lcr3(uint val)
 {